@@ -1,5 +1,7 @@
 #include "aabb.h" 
 
+#include <algorithm>
+
 // @@@@@@ VOTRE CODE ICI
 // Implémenter l'intersection d'un rayon avec un AABB dans l'intervalle décrit.
 bool AABB::intersect(Ray ray, double t_min, double t_max)  {
@@ -67,4 +69,65 @@ AABB combine(AABB a, AABB b) {
 
 bool compare(AABB a, AABB b, int axis){
 	return a.min[axis] < b.min[axis];
-};
\ No newline at end of file
+};
+
+double surface_area(AABB aabb) {
+	double3 d = aabb.max - aabb.min;
+	if (d.x < 0 || d.y < 0 || d.z < 0) {
+		return 0;
+	}
+	return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+};
+
+double3 centroid(AABB aabb) {
+	return 0.5 * (aabb.min + aabb.max);
+};
+
+AABB transform_aabb(AABB aabb, double4x4 transform) {
+	std::vector<double3> corners = retrieve_corners(aabb);
+	for (auto& corner : corners) {
+		corner = mul(transform, double4{corner, 1}).xyz();
+	}
+	return construct_aabb(corners);
+};
+
+AABB intersect_aabb(AABB a, AABB b) {
+	return AABB{max(a.min,b.min),min(a.max,b.max)};
+};
+
+AABB clip_triangle(double3 a, double3 b, double3 c, int axis, double lo, double hi) {
+	// Sutherland-Hodgman against the two planes; each plane adds at most one vertex.
+	double3 polygon[5] = {a, b, c};
+	int n = 3;
+
+	for (int side = 0; side < 2 && n > 0; side++) {
+		double3 clipped[5];
+		int m = 0;
+		auto inside = [&](const double3& p) { return side == 0 ? p[axis] >= lo : p[axis] <= hi; };
+		double plane = side == 0 ? lo : hi;
+
+		for (int i = 0; i < n; i++) {
+			const double3& p = polygon[i];
+			const double3& q = polygon[(i + 1) % n];
+			if (inside(p)) {
+				clipped[m++] = p;
+			}
+			if (inside(p) != inside(q)) {
+				double t = (plane - p[axis]) / (q[axis] - p[axis]);
+				double3 r = p + t * (q - p);
+				r[axis] = plane;
+				clipped[m++] = r;
+			}
+		}
+
+		std::copy(clipped, clipped + m, polygon);
+		n = m;
+	}
+
+	AABB aabb = AABB{double3{DBL_MAX,DBL_MAX,DBL_MAX},double3{-DBL_MAX,-DBL_MAX,-DBL_MAX}};
+	for (int i = 0; i < n; i++) {
+		aabb.min = min(aabb.min, polygon[i]);
+		aabb.max = max(aabb.max, polygon[i]);
+	}
+	return aabb;
+};
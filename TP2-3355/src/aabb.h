@@ -26,4 +26,20 @@ AABB construct_aabb(std::vector<double3> points);
 AABB combine(AABB a, AABB b);
 
 // Détermine si le coin inférieur de b est plus grand que a par rapport à l'axe spécifiée.
-bool compare(AABB a, AABB b, int axis);
\ No newline at end of file
+bool compare(AABB a, AABB b, int axis);
+
+// Aire de la surface du AABB. Retourne 0 pour un AABB vide.
+double surface_area(AABB aabb);
+
+// Centre du AABB.
+double3 centroid(AABB aabb);
+
+// Transforme un AABB local par la matrice donnée et retourne le AABB global qui englobe ses 8 coins.
+AABB transform_aabb(AABB aabb, double4x4 transform);
+
+// Intersection de deux AABB (vide, min > max, s'ils sont disjoints).
+AABB intersect_aabb(AABB a, AABB b);
+
+// AABB de la partie du triangle (a, b, c) comprise entre les plans axis = lo et axis = hi.
+// Retourne un AABB vide si le triangle ne traverse pas la tranche.
+AABB clip_triangle(double3 a, double3 b, double3 c, int axis, double lo, double hi);
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "animation.h"
+
+#include <algorithm>
+
+#include "object.h"
+
+double4x4 TransformOp::evaluate(double frame) const {
+    // Paramètres à l'image donnée : constants hors de l'intervalle des images clés.
+    double p[4];
+    if (keys.size() == 1 || frame <= keys.front().frame) {
+        std::copy(keys.front().params, keys.front().params + 4, p);
+    } else if (frame >= keys.back().frame) {
+        std::copy(keys.back().params, keys.back().params + 4, p);
+    } else {
+        size_t ikey = 1;
+        while (keys[ikey].frame < frame) {
+            ikey++;
+        }
+        const TransformKey& a = keys[ikey - 1];
+        const TransformKey& b = keys[ikey];
+        double s = (frame - a.frame) / (b.frame - a.frame);
+        for (int i = 0; i < 4; i++) {
+            p[i] = a.params[i] + (b.params[i] - a.params[i]) * s;
+        }
+    }
+
+    // Mêmes matrices que Parser::parse_Translate, parse_Rotate et parse_Scale.
+    switch (type) {
+        case TRANSFORM_TRANSLATE:
+            return linalg::translation_matrix(double3{p[0], p[1], p[2]});
+        case TRANSFORM_ROTATE:
+            return linalg::rotation_matrix(linalg::rotation_quat(double3{p[1], p[2], p[3]}, deg2rad(p[0])));
+        case TRANSFORM_SCALE:
+            return linalg::scaling_matrix(double3{p[0], p[1], p[2]});
+    }
+    return linalg::identity;
+}
+
+double4x4 evaluate_transform(const std::vector<TransformOp>& ops, double frame) {
+    double4x4 m = linalg::identity;
+    for (const TransformOp& op : ops) {
+        m = mul(m, op.evaluate(frame));
+    }
+    return m;
+}
+
+void apply_animations(const std::vector<ObjectAnimation>& animations, double frame) {
+    for (const ObjectAnimation& animation : animations) {
+        animation.object->setup_transform(evaluate_transform(animation.ops, frame));
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "basic.h"
+#include "linalg/linalg.h"
+using namespace linalg::aliases;
+
+class Object;
+
+// Opérations de transformation de la pile du Parser.
+enum TransformOpType {
+    TRANSFORM_TRANSLATE,
+    TRANSFORM_ROTATE,
+    TRANSFORM_SCALE,
+};
+
+// Image clé d'une opération : ses paramètres à une image donnée.
+// Translate et Scale : (x, y, z) ; Rotate : (angle en degrés, x, y, z).
+struct TransformKey {
+    double frame;
+    double params[4];
+};
+
+// Une opération de la pile de transformations. Une opération fixe n'a qu'une image clé ;
+// sinon ses paramètres sont interpolés linéairement entre les images clés (triées par image)
+// et gardés constants avant la première et après la dernière.
+struct TransformOp {
+    TransformOpType type;
+    std::vector<TransformKey> keys;
+
+    bool animated() const { return keys.size() > 1; }
+
+    // Matrice de l'opération à l'image donnée.
+    double4x4 evaluate(double frame) const;
+};
+
+// Produit des opérations évaluées à l'image donnée, dans l'ordre de la scène.
+double4x4 evaluate_transform(const std::vector<TransformOp>& ops, double frame);
+
+// Objet dont la transformation dépend de l'image : ops est la pile complète au moment de sa création.
+struct ObjectAnimation {
+    Object* object;
+    std::vector<TransformOp> ops;
+};
+
+// Met à jour Object::transform (et ses inverses) de chaque objet animé pour l'image donnée.
+// Les conteneurs doivent ensuite être mis à jour (IContainer::update).
+void apply_animations(const std::vector<ObjectAnimation>& animations, double frame);
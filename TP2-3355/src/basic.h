@@ -1,28 +1,30 @@
 #pragma once
 
+#include <cmath>
+
 #include "linalg/linalg.h"
 using namespace linalg::aliases;
 
 #define PI 3.14159265358979323846
 #define EPSILON 1e-6
 
-// Valeur aléatoire entre [0,1)
-static double rand_double() {
-	return double(rand()) / double((RAND_MAX));
-}
-
-// Valeur aléatoire entre [0,1] pour un vecteur
-static double2 rand_double2() {
-	return double2{rand_double(),rand_double()};
-}
+// Transforme un point uniforme de [0,1)^2 en un point uniforme du disque unité.
+// Projection concentrique de Shirley-Chiu : sans rejet, chaque appel consomme exactement 2 valeurs.
+static double2 square_to_unit_disk(double2 u) {
+    double2 p = 2.0 * u - 1.0;
+    if (p.x == 0 && p.y == 0) {
+        return double2{0, 0};
+    }
 
-// Valeur aléatoire à l'intérieur d'un disque.
-static double2 random_in_unit_disk() {
-    while (true) {
-        auto p = (2.0 * rand_double2() - 1.0);
-        if (length2(p) >= 1) continue;
-        return p;
+    double r, theta;
+    if (std::abs(p.x) > std::abs(p.y)) {
+        r = p.x;
+        theta = (PI / 4) * (p.y / p.x);
+    } else {
+        r = p.y;
+        theta = (PI / 2) - (PI / 4) * (p.x / p.y);
     }
+    return r * double2{std::cos(theta), std::sin(theta)};
 }
 
 // Convertir radian vers degrée
@@ -48,4 +50,18 @@ public:
 
 	double3 origin;    // Origine du rayon
 	double3 direction; // Direction du rayon
-};
\ No newline at end of file
+};
+
+// Nombre maximal de rayons dans un paquet (4x4 pixels, ou les rayons d'ombre d'une lumière).
+#define PACKET_MAX_RAYS 16
+
+// Un paquet de rayons cohérents (origines et directions voisines) traversant le BVH ensemble.
+struct RayPacket
+{
+	int count = 0;
+	Ray rays[PACKET_MAX_RAYS];
+
+	// Intervalle de recherche ; t_max est propre à chaque rayon.
+	double t_min = 0;
+	double t_max[PACKET_MAX_RAYS];
+};
@@ -0,0 +1,806 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#include "thread_pool.h"
+
+struct BVHTree::BuildContext {
+    // nullptr : construction séquentielle.
+    ThreadPool* pool;
+    std::atomic<int> tasks;
+    std::atomic<int> parallel_binning_nodes;
+};
+
+struct BVHTree::SBVHState {
+    const BVHClipFn* clip;
+    double root_area;
+    // Références dupliquées encore permises.
+    int budget;
+    // Références des feuilles, dans l'ordre de création des feuilles.
+    std::vector<BVHObjectInfo> output;
+
+    // Boîte de la partie de la référence comprise dans la tranche [lo, hi] de l'axe.
+    AABB clip_ref(const BVHObjectInfo& ref, int axis, double lo, double hi) const {
+        if (clip) {
+            return (*clip)(ref.idx, ref.aabb, axis, lo, hi);
+        }
+        AABB aabb = ref.aabb;
+        aabb.min[axis] = std::max(aabb.min[axis], lo);
+        aabb.max[axis] = std::min(aabb.max[axis], hi);
+        return aabb;
+    }
+};
+
+namespace {
+    // Boîte vide : résultat de intersect_aabb ou de clip_triangle sans recouvrement.
+    bool is_empty(const AABB& aabb) {
+        return aabb.min.x > aabb.max.x || aabb.min.y > aabb.max.y || aabb.min.z > aabb.max.z;
+    }
+
+    // Boîte d'un noeud et boîte de ses centroïdes.
+    struct NodeBounds {
+        AABB bounds;
+        AABB centroid_bounds;
+    };
+
+    // Paniers SAH des trois axes.
+    struct SAHBins {
+        int counts[3][BVH_SAH_BINS];
+        AABB bounds[3][BVH_SAH_BINS];
+    };
+
+    int sah_bin(double c, double cmin, double extent) {
+        return std::min(BVH_SAH_BINS - 1, static_cast<int>(BVH_SAH_BINS * (c - cmin) / extent));
+    }
+
+    // Intercale deux bits nuls entre chacun des 21 bits de faible poids de v.
+    uint64_t spread_bits(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffff;
+        v = (v | v << 16) & 0x1f0000ff0000ff;
+        v = (v | v << 8) & 0x100f00f00f00f00f;
+        v = (v | v << 4) & 0x10c30c30c30c30c3;
+        v = (v | v << 2) & 0x1249249249249249;
+        return v;
+    }
+
+    // Code de Morton du centroïde c quantifié sur 2^bits_per_axis cellules par axe de bounds.
+    // Les bits sont entrelacés x, y, z du poids fort au poids faible : le bit b appartient à l'axe 2 - b % 3.
+    uint64_t morton_code(const double3& c, const AABB& bounds, int bits_per_axis) {
+        double cells = static_cast<double>(uint64_t(1) << bits_per_axis);
+        uint64_t code = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            double extent = bounds.max[axis] - bounds.min[axis];
+            double q = extent > 0 ? (c[axis] - bounds.min[axis]) / extent * cells : 0;
+            uint64_t cell = static_cast<uint64_t>(std::min(std::max(q, 0.0), cells - 1));
+            code |= spread_bits(cell) << (2 - axis);
+        }
+        return code;
+    }
+
+    // Tri par base (octet par octet, stable) de infos selon codes ; num_bits est le nombre de bits utiles.
+    // On trie des paires (code, indice) de 16 octets, puis infos est permuté une seule fois.
+    void radix_sort(std::vector<BVHObjectInfo>& infos, std::vector<uint64_t>& codes, int num_bits) {
+        struct Key {
+            uint64_t code;
+            uint32_t index;
+        };
+        std::vector<Key> keys(codes.size());
+        std::vector<Key> keys_tmp(codes.size());
+        for (size_t i = 0; i < codes.size(); i++) {
+            keys[i] = {codes[i], static_cast<uint32_t>(i)};
+        }
+
+        for (int shift = 0; shift < num_bits; shift += 8) {
+            int offsets[256] = {};
+            for (const Key& key : keys) {
+                offsets[(key.code >> shift) & 0xff]++;
+            }
+            // Octet identique pour tous les codes : la passe ne changerait rien.
+            if (offsets[(keys[0].code >> shift) & 0xff] == static_cast<int>(keys.size())) {
+                continue;
+            }
+            int total = 0;
+            for (int& offset : offsets) {
+                int n = offset;
+                offset = total;
+                total += n;
+            }
+            for (const Key& key : keys) {
+                keys_tmp[offsets[(key.code >> shift) & 0xff]++] = key;
+            }
+            keys.swap(keys_tmp);
+        }
+
+        std::vector<BVHObjectInfo> sorted(infos.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            sorted[i] = infos[keys[i].index];
+            codes[i] = keys[i].code;
+        }
+        infos.swap(sorted);
+    }
+
+    // Coût d'intersection de n primitives, testées par groupes de leaf_width.
+    int leaf_groups(int n, int leaf_width) {
+        return (n + leaf_width - 1) / leaf_width;
+    }
+
+    // Applique fn(begin, end, &partial) sur [begin, end) : d'un seul coup sans pool, sinon par morceaux
+    // de BVH_BUILD_CHUNK_SIZE en parallèle. Retourne un résultat partiel par morceau, initialisé à init.
+    template <typename T, typename Fn>
+    std::vector<T> map_chunks(ThreadPool* pool, int begin, int end, const T& init, Fn&& fn) {
+        int num_chunks = pool ? (end - begin + BVH_BUILD_CHUNK_SIZE - 1) / BVH_BUILD_CHUNK_SIZE : 1;
+        std::vector<T> partial(num_chunks, init);
+        auto run = [&](int ichunk, int) {
+            int chunk_begin = begin + ichunk * BVH_BUILD_CHUNK_SIZE;
+            int chunk_end = pool ? std::min(chunk_begin + BVH_BUILD_CHUNK_SIZE, end) : end;
+            fn(chunk_begin, chunk_end, &partial[ichunk]);
+        };
+        if (pool) {
+            parallel_for(*pool, num_chunks, run);
+        } else {
+            run(0, 0);
+        }
+        return partial;
+    }
+
+    // AABB et AABB des centroïdes de v[begin, end).
+    NodeBounds compute_node_bounds(const std::vector<BVHObjectInfo>& v, int begin, int end, ThreadPool* pool) {
+        NodeBounds empty_bounds = {construct_aabb({}), construct_aabb({})};
+        auto partial_bounds = map_chunks(pool, begin, end, empty_bounds, [&](int chunk_begin, int chunk_end, NodeBounds* partial) {
+            for (int i = chunk_begin; i < chunk_end; i++) {
+                partial->bounds = combine(partial->bounds, v[i].aabb);
+                double3 c = centroid(v[i].aabb);
+                partial->centroid_bounds = combine(partial->centroid_bounds, AABB{c, c});
+            }
+        });
+
+        NodeBounds result = empty_bounds;
+        for (auto& partial : partial_bounds) {
+            result.bounds = combine(result.bounds, partial.bounds);
+            result.centroid_bounds = combine(result.centroid_bounds, partial.centroid_bounds);
+        }
+        return result;
+    }
+
+    // Répartit les centroïdes de v[begin, end) dans les paniers des trois axes en un seul passage.
+    // Les axes dont l'étendue des centroïdes est nulle restent vides.
+    SAHBins bin_centroids(const std::vector<BVHObjectInfo>& v, int begin, int end, const AABB& centroid_bounds,
+                          ThreadPool* pool) {
+        double3 centroid_extent = centroid_bounds.max - centroid_bounds.min;
+        SAHBins empty_bins = {};
+        for (int axis = 0; axis < 3; axis++) {
+            for (auto& b : empty_bins.bounds[axis]) {
+                b = construct_aabb({});
+            }
+        }
+
+        auto partial_bins = map_chunks(pool, begin, end, empty_bins, [&](int chunk_begin, int chunk_end, SAHBins* partial) {
+            for (int i = chunk_begin; i < chunk_end; i++) {
+                double3 c = centroid(v[i].aabb);
+                for (int axis = 0; axis < 3; axis++) {
+                    if (centroid_extent[axis] <= 0) {
+                        continue;
+                    }
+                    int b = sah_bin(c[axis], centroid_bounds.min[axis], centroid_extent[axis]);
+                    partial->counts[axis][b]++;
+                    partial->bounds[axis][b] = combine(partial->bounds[axis][b], v[i].aabb);
+                }
+            }
+        });
+
+        SAHBins bins = empty_bins;
+        for (auto& partial : partial_bins) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < BVH_SAH_BINS; b++) {
+                    bins.counts[axis][b] += partial.counts[axis][b];
+                    bins.bounds[axis][b] = combine(bins.bounds[axis][b], partial.bounds[axis][b]);
+                }
+            }
+        }
+        return bins;
+    }
+
+    // Meilleure séparation par objets : les paniers [0, split) de l'axe vont à gauche.
+    // axis vaut -1 si aucune séparation ne laisse d'objets des deux côtés.
+    struct ObjectSplit {
+        double cost;
+        int axis;
+        int split;
+    };
+
+    ObjectSplit find_object_split(const SAHBins& bins, const AABB& centroid_bounds, double node_area, int count,
+                                  int leaf_width) {
+        ObjectSplit best = {DBL_MAX, -1, 0};
+
+        for (int axis = 0; axis < 3; axis++) {
+            double extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            if (extent <= 0) {
+                continue;
+            }
+
+            const int* bin_counts = bins.counts[axis];
+            const AABB* bin_bounds = bins.bounds[axis];
+
+            // Balayage de droite à gauche pour les aires cumulées du côté droit.
+            double right_area[BVH_SAH_BINS];
+            int right_count[BVH_SAH_BINS];
+            AABB acc = construct_aabb({});
+            int acc_count = 0;
+            for (int b = BVH_SAH_BINS - 1; b > 0; b--) {
+                acc = combine(acc, bin_bounds[b]);
+                acc_count += bin_counts[b];
+                right_area[b] = surface_area(acc);
+                right_count[b] = acc_count;
+            }
+
+            // Balayage de gauche à droite : la séparation s place les paniers [0,s) à gauche.
+            acc = construct_aabb({});
+            acc_count = 0;
+            for (int split = 1; split < BVH_SAH_BINS; split++) {
+                acc = combine(acc, bin_bounds[split - 1]);
+                acc_count += bin_counts[split - 1];
+                if (acc_count == 0 || right_count[split] == 0) {
+                    continue;
+                }
+
+                double cost = leaf_groups(acc_count, leaf_width) * surface_area(acc)
+                            + leaf_groups(right_count[split], leaf_width) * right_area[split];
+                cost = node_area > 0 ? BVH_TRAVERSAL_COST + cost / node_area
+                                     : BVH_TRAVERSAL_COST + leaf_groups(count, leaf_width);
+                if (cost < best.cost) {
+                    best = {cost, axis, split};
+                }
+            }
+        }
+        return best;
+    }
+}
+
+void BVHBuildReport::print(std::ostream& out) const {
+    out << primitives << " primitives, ";
+    if (references > primitives) {
+        out << references << " references, ";
+    }
+    if (cached) {
+        out << nodes << " nodes loaded from cache in " << milliseconds << " ms" << std::endl;
+        return;
+    }
+    out << nodes << " nodes in " << milliseconds << " ms ("
+        << threads << " thread(s), " << tasks << " subtree tasks, "
+        << parallel_binning_nodes << " nodes binned in parallel)" << std::endl;
+}
+
+void BVHTree::build(std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width, ThreadPool* pool,
+                    const BVHClipFn& clip) {
+    auto start = std::chrono::steady_clock::now();
+    nodes.clear();
+    report = {};
+    report.primitives = static_cast<int>(infos.size());
+    report.threads = 1;
+    if (infos.empty()) {
+        return;
+    }
+
+    // Un petit arbre ne justifie pas la découpe en tâches.
+    BuildContext ctx;
+    ctx.pool = nullptr;
+    if (pool && pool->size() > 1 && method != SPLIT_SBVH && infos.size() >= BVH_PARALLEL_MIN_PRIMITIVES) {
+        ctx.pool = pool;
+        report.threads = pool->size();
+    }
+
+    ctx.tasks = 0;
+    ctx.parallel_binning_nodes = 0;
+
+    // Les trois premières méthodes réordonnent infos sur place ; la SBVH le remplace.
+    BVHNode* root;
+    if (method == SPLIT_SBVH) {
+        SBVHState state;
+        state.clip = clip ? &clip : nullptr;
+        state.root_area = surface_area(compute_node_bounds(infos, 0, infos.size(), nullptr).bounds);
+        state.budget = static_cast<int>(infos.size() * BVH_SBVH_REFERENCE_BUDGET);
+        state.output.reserve(infos.size());
+
+        root = recursive_build_sbvh(infos, 0, leaf_width, state);
+        infos.swap(state.output);
+    } else if (method == SPLIT_SAH) {
+        root = recursive_build_sah(infos, 0, infos.size(), 0, leaf_width, ctx);
+    } else if (method == SPLIT_LBVH) {
+        AABB centroid_bounds = construct_aabb({});
+        for (auto& info : infos) {
+            double3 c = centroid(info.aabb);
+            centroid_bounds = combine(centroid_bounds, AABB{c, c});
+        }
+
+        int bits_per_axis = infos.size() >= BVH_LBVH_WIDE_CODES_MIN ? 21 : 10;
+        std::vector<uint64_t> codes(infos.size());
+        for (size_t i = 0; i < infos.size(); i++) {
+            codes[i] = morton_code(centroid(infos[i].aabb), centroid_bounds, bits_per_axis);
+        }
+        radix_sort(infos, codes, 3 * bits_per_axis);
+
+        root = recursive_build_lbvh(infos, codes, 0, infos.size(), 0,
+                                    std::max(BVH_MAX_LEAF_SIZE, leaf_width), ctx);
+    } else {
+        root = recursive_build(infos, 0, infos.size(), 0, ctx);
+    }
+
+    // L'arbre de pointeurs ne sert qu'à la construction.
+    flatten(root);
+    delete_tree(root);
+
+    report.references = static_cast<int>(infos.size());
+    report.nodes = static_cast<int>(nodes.size());
+    report.tasks = ctx.tasks;
+    report.parallel_binning_nodes = ctx.parallel_binning_nodes;
+    report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename LeftFn, typename RightFn>
+void BVHTree::build_children(int count, BuildContext& ctx, LeftFn&& left, RightFn&& right) {
+    if (ctx.pool == nullptr || count < BVH_PARALLEL_TASK_MIN) {
+        left();
+        right();
+        return;
+    }
+
+    // Les deux enfants couvrent des plages disjointes de bvhs : ils peuvent être construits en même temps.
+    ctx.tasks++;
+    TaskGroup group;
+    ctx.pool->submit(group, [&] { left(); });
+    right();
+    ctx.pool->wait(group);
+}
+
+BVHNode* BVHTree::recursive_build(std::vector<BVHObjectInfo>& bvhs, int idx_start, int idx_end, int axis,
+                                   BuildContext& ctx) {
+    BVHNode* node = new BVHNode{};
+
+    auto comparator = [=](const BVHObjectInfo& a, const BVHObjectInfo& b) {
+        return compare(a.aabb,b.aabb,axis);
+    };
+
+    //s'il y a un seul élément, il s'agit d'une feuille. On arrête la récursion.
+    if (idx_end - idx_start == 1){
+        node->left = node->right = nullptr;
+        node->idx = idx_start;
+        node->count = 1;
+        node->aabb = bvhs[idx_start].aabb;
+    }
+    // sinon, on parcourt récursivement
+    else {
+        std::sort(bvhs.begin() + idx_start, bvhs.begin() + idx_end, comparator);
+
+        int mid = idx_start + (idx_end - idx_start)/2;
+        build_children(idx_end - idx_start, ctx,
+                       [&] { node->left = recursive_build(bvhs, idx_start, mid, (axis+1)%3, ctx); },
+                       [&] { node->right = recursive_build(bvhs, mid, idx_end, (axis+1)%3, ctx); });
+        node->aabb = combine(node->left->aabb,node->right->aabb);
+        node->axis = axis;
+        node->idx = -1;
+        node->count = 0;
+    }
+
+    return node;
+}
+
+BVHNode* BVHTree::recursive_build_sah(std::vector<BVHObjectInfo>& bvhs, int idx_start, int idx_end, int depth,
+                                      int leaf_width, BuildContext& ctx) {
+    BVHNode* node = new BVHNode{};
+    int count = idx_end - idx_start;
+
+    int max_leaf_size = std::max(BVH_MAX_LEAF_SIZE, leaf_width);
+
+    // Les noeuds du haut de l'arbre parcourent leurs objets par morceaux, en parallèle.
+    // Les réductions (min/max et comptes) ne dépendent pas de l'ordre des morceaux.
+    ThreadPool* binning_pool = count >= BVH_PARALLEL_BINNING_MIN ? ctx.pool : nullptr;
+    if (binning_pool) {
+        ctx.parallel_binning_nodes++;
+    }
+
+    // AABB du noeud et AABB des centroïdes (sert à positionner les paniers).
+    NodeBounds node_bounds = compute_node_bounds(bvhs, idx_start, idx_end, binning_pool);
+    AABB bounds = node_bounds.bounds;
+    AABB centroid_bounds = node_bounds.centroid_bounds;
+    node->aabb = bounds;
+
+    auto make_leaf = [&]() {
+        node->left = node->right = nullptr;
+        node->idx = idx_start;
+        node->count = count;
+        return node;
+    };
+
+    if (count == 1) {
+        return make_leaf();
+    }
+
+    // Évalue toutes les séparations entre paniers sur les trois axes.
+    double node_area = surface_area(bounds);
+    ObjectSplit best = {DBL_MAX, -1, 0};
+    if (depth < BVH_MAX_SAH_DEPTH) {
+        SAHBins bins = bin_centroids(bvhs, idx_start, idx_end, centroid_bounds, binning_pool);
+        best = find_object_split(bins, centroid_bounds, node_area, count, leaf_width);
+    }
+    double best_cost = best.cost;
+    int best_axis = best.axis;
+    int best_split = best.split;
+
+    int mid;
+    if (best_axis < 0) {
+        // Tous les centroïdes sont confondus (ou l'arbre est trop profond) : séparation à la médiane.
+        if (count <= max_leaf_size) {
+            return make_leaf();
+        }
+
+        int axis = 0;
+        double3 extent = centroid_bounds.max - centroid_bounds.min;
+        if (extent.y > extent[axis]) axis = 1;
+        if (extent.z > extent[axis]) axis = 2;
+
+        best_axis = axis;
+        mid = idx_start + count / 2;
+        std::nth_element(bvhs.begin() + idx_start, bvhs.begin() + mid, bvhs.begin() + idx_end,
+                         [=](const BVHObjectInfo& a, const BVHObjectInfo& b) {
+                             return centroid(a.aabb)[axis] < centroid(b.aabb)[axis];
+                         });
+    } else {
+        if (count <= max_leaf_size && leaf_groups(count, leaf_width) <= best_cost) {
+            return make_leaf();
+        }
+
+        double extent = centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis];
+        double cmin = centroid_bounds.min[best_axis];
+        auto it = std::partition(bvhs.begin() + idx_start, bvhs.begin() + idx_end, [&](const BVHObjectInfo& info) {
+            return sah_bin(centroid(info.aabb)[best_axis], cmin, extent) < best_split;
+        });
+        mid = static_cast<int>(it - bvhs.begin());
+    }
+
+    node->axis = best_axis;
+    build_children(count, ctx,
+                   [&] { node->left = recursive_build_sah(bvhs, idx_start, mid, depth + 1, leaf_width, ctx); },
+                   [&] { node->right = recursive_build_sah(bvhs, mid, idx_end, depth + 1, leaf_width, ctx); });
+    node->idx = -1;
+    node->count = 0;
+
+    return node;
+}
+
+BVHNode* BVHTree::recursive_build_lbvh(std::vector<BVHObjectInfo>& bvhs, const std::vector<uint64_t>& codes,
+                                       int idx_start, int idx_end, int depth, int max_leaf_size, BuildContext& ctx) {
+    BVHNode* node = new BVHNode{};
+    int count = idx_end - idx_start;
+
+    if (count <= max_leaf_size) {
+        node->left = node->right = nullptr;
+        node->idx = idx_start;
+        node->count = count;
+        node->aabb = bvhs[idx_start].aabb;
+        for (int i = idx_start + 1; i < idx_end; i++) {
+            node->aabb = combine(node->aabb, bvhs[i].aabb);
+        }
+        return node;
+    }
+
+    // Les codes sont triés : la plage se sépare là où le bit le plus significatif qui diffère
+    // entre ses extrémités passe à 1.
+    uint64_t diff = codes[idx_start] ^ codes[idx_end - 1];
+    int mid;
+    if (diff == 0 || depth >= BVH_MAX_SAH_DEPTH) {
+        // Codes identiques (ou arbre trop profond) : séparation à la médiane, les voisins restent ensemble.
+        mid = idx_start + count / 2;
+        node->axis = depth % 3;
+    } else {
+        int bit = 63;
+        while (!((diff >> bit) & 1)) {
+            bit--;
+        }
+        uint64_t mask = uint64_t(1) << bit;
+        mid = static_cast<int>(std::partition_point(codes.begin() + idx_start, codes.begin() + idx_end,
+                                                    [=](uint64_t code) { return !(code & mask); }) - codes.begin());
+        node->axis = 2 - bit % 3;
+    }
+
+    build_children(count, ctx,
+                   [&] { node->left = recursive_build_lbvh(bvhs, codes, idx_start, mid, depth + 1, max_leaf_size, ctx); },
+                   [&] { node->right = recursive_build_lbvh(bvhs, codes, mid, idx_end, depth + 1, max_leaf_size, ctx); });
+    node->aabb = combine(node->left->aabb, node->right->aabb);
+    node->idx = -1;
+    node->count = 0;
+
+    return node;
+}
+
+BVHNode* BVHTree::recursive_build_sbvh(std::vector<BVHObjectInfo>& refs, int depth, int leaf_width, SBVHState& state) {
+    BVHNode* node = new BVHNode{};
+    int count = static_cast<int>(refs.size());
+    int max_leaf_size = std::max(BVH_MAX_LEAF_SIZE, leaf_width);
+
+    NodeBounds node_bounds = compute_node_bounds(refs, 0, count, nullptr);
+    AABB bounds = node_bounds.bounds;
+    AABB centroid_bounds = node_bounds.centroid_bounds;
+    node->aabb = bounds;
+
+    auto make_leaf = [&]() {
+        node->left = node->right = nullptr;
+        node->idx = static_cast<int>(state.output.size());
+        node->count = count;
+        state.output.insert(state.output.end(), refs.begin(), refs.end());
+        return node;
+    };
+
+    if (count == 1) {
+        return make_leaf();
+    }
+
+    double node_area = surface_area(bounds);
+    ObjectSplit object_split = {DBL_MAX, -1, 0};
+    SAHBins bins;
+    if (depth < BVH_MAX_SAH_DEPTH) {
+        bins = bin_centroids(refs, 0, count, centroid_bounds, nullptr);
+        object_split = find_object_split(bins, centroid_bounds, node_area, count, leaf_width);
+    }
+
+    // Séparation spatiale : n'est cherchée que si les enfants de la séparation par objets se
+    // chevauchent notablement et qu'il reste du budget de références.
+    double spatial_cost = DBL_MAX;
+    int spatial_axis = -1;
+    double spatial_pos = 0;
+    AABB spatial_left, spatial_right;
+    int spatial_left_count = 0, spatial_right_count = 0;
+
+    if (object_split.axis >= 0 && state.budget > 0 && node_area > 0) {
+        AABB left = construct_aabb({});
+        AABB right = construct_aabb({});
+        for (int b = 0; b < BVH_SAH_BINS; b++) {
+            AABB& side = b < object_split.split ? left : right;
+            side = combine(side, bins.bounds[object_split.axis][b]);
+        }
+
+        AABB overlap = intersect_aabb(left, right);
+        if (!is_empty(overlap) && surface_area(overlap) > BVH_SBVH_ALPHA * state.root_area) {
+            for (int axis = 0; axis < 3; axis++) {
+                double extent = bounds.max[axis] - bounds.min[axis];
+                if (!(extent > 0)) {
+                    continue;
+                }
+                double width = extent / BVH_SBVH_BINS;
+                auto bin_of = [&](double x) {
+                    return std::min(BVH_SBVH_BINS - 1, std::max(0, static_cast<int>((x - bounds.min[axis]) / width)));
+                };
+                auto plane = [&](int b) { return b == BVH_SBVH_BINS ? bounds.max[axis] : bounds.min[axis] + b * width; };
+
+                // Chaque référence entre dans le premier panier qu'elle touche et sort du dernier ;
+                // sa partie découpée dans chaque panier traversé agrandit la boîte du panier.
+                int entries[BVH_SBVH_BINS] = {};
+                int exits[BVH_SBVH_BINS] = {};
+                AABB bin_bounds[BVH_SBVH_BINS];
+                for (auto& b : bin_bounds) {
+                    b = construct_aabb({});
+                }
+                for (const BVHObjectInfo& ref : refs) {
+                    int first = bin_of(ref.aabb.min[axis]);
+                    int last = bin_of(ref.aabb.max[axis]);
+                    for (int b = first; b <= last; b++) {
+                        AABB part = first == last ? ref.aabb : state.clip_ref(ref, axis, plane(b), plane(b + 1));
+                        bin_bounds[b] = combine(bin_bounds[b], part);
+                    }
+                    entries[first]++;
+                    exits[last]++;
+                }
+
+                double right_area[BVH_SBVH_BINS];
+                int right_count[BVH_SBVH_BINS];
+                AABB right_acc[BVH_SBVH_BINS];
+                AABB acc = construct_aabb({});
+                int acc_count = 0;
+                for (int b = BVH_SBVH_BINS - 1; b > 0; b--) {
+                    acc = combine(acc, bin_bounds[b]);
+                    acc_count += exits[b];
+                    right_acc[b] = acc;
+                    right_area[b] = surface_area(acc);
+                    right_count[b] = acc_count;
+                }
+
+                acc = construct_aabb({});
+                acc_count = 0;
+                for (int split = 1; split < BVH_SBVH_BINS; split++) {
+                    acc = combine(acc, bin_bounds[split - 1]);
+                    acc_count += entries[split - 1];
+                    if (acc_count == 0 || right_count[split] == 0) {
+                        continue;
+                    }
+
+                    double cost = leaf_groups(acc_count, leaf_width) * surface_area(acc)
+                                + leaf_groups(right_count[split], leaf_width) * right_area[split];
+                    cost = BVH_TRAVERSAL_COST + cost / node_area;
+                    int duplicates = acc_count + right_count[split] - count;
+                    if (cost < spatial_cost && duplicates <= state.budget) {
+                        spatial_cost = cost;
+                        spatial_axis = axis;
+                        spatial_pos = plane(split);
+                        spatial_left = acc;
+                        spatial_right = right_acc[split];
+                        spatial_left_count = acc_count;
+                        spatial_right_count = right_count[split];
+                    }
+                }
+            }
+        }
+    }
+
+    double best_cost = std::min(object_split.cost, spatial_cost);
+    if (count <= max_leaf_size && (object_split.axis < 0 || leaf_groups(count, leaf_width) <= best_cost)) {
+        return make_leaf();
+    }
+
+    std::vector<BVHObjectInfo> left_refs;
+    std::vector<BVHObjectInfo> right_refs;
+    int duplicates = 0;
+
+    if (spatial_axis >= 0 && spatial_cost < object_split.cost) {
+        int axis = spatial_axis;
+        int left_count = spatial_left_count;
+        int right_count = spatial_right_count;
+        for (const BVHObjectInfo& ref : refs) {
+            if (ref.aabb.max[axis] <= spatial_pos) {
+                left_refs.push_back(ref);
+                continue;
+            }
+            if (ref.aabb.min[axis] >= spatial_pos) {
+                right_refs.push_back(ref);
+                continue;
+            }
+
+            // Référence à cheval : on la garde d'un seul côté lorsque cela coûte moins cher que de
+            // la dupliquer (sans jamais vider un côté).
+            double split_cost = surface_area(spatial_left) * left_count + surface_area(spatial_right) * right_count;
+            double left_only = right_count > 1
+                ? surface_area(combine(spatial_left, ref.aabb)) * left_count + surface_area(spatial_right) * (right_count - 1)
+                : DBL_MAX;
+            double right_only = left_count > 1
+                ? surface_area(spatial_left) * (left_count - 1) + surface_area(combine(spatial_right, ref.aabb)) * right_count
+                : DBL_MAX;
+
+            if (left_only < split_cost && left_only <= right_only) {
+                left_refs.push_back(ref);
+                spatial_left = combine(spatial_left, ref.aabb);
+                right_count--;
+            } else if (right_only < split_cost) {
+                right_refs.push_back(ref);
+                spatial_right = combine(spatial_right, ref.aabb);
+                left_count--;
+            } else {
+                AABB left_part = state.clip_ref(ref, axis, ref.aabb.min[axis], spatial_pos);
+                AABB right_part = state.clip_ref(ref, axis, spatial_pos, ref.aabb.max[axis]);
+                bool in_left = !is_empty(left_part);
+                bool in_right = !is_empty(right_part);
+                if (in_left) {
+                    left_refs.push_back(BVHObjectInfo{ref.idx, left_part});
+                }
+                if (in_right) {
+                    right_refs.push_back(BVHObjectInfo{ref.idx, right_part});
+                }
+                if (!in_left && !in_right) {
+                    left_refs.push_back(ref);
+                }
+                duplicates += in_left && in_right;
+            }
+        }
+        node->axis = axis;
+    }
+
+    // Séparation par objets (ou séparation spatiale qui laisserait un côté vide).
+    if (left_refs.empty() || right_refs.empty()) {
+        duplicates = 0;
+        left_refs.clear();
+        right_refs.clear();
+        if (object_split.axis >= 0) {
+            int axis = object_split.axis;
+            double extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            for (const BVHObjectInfo& ref : refs) {
+                bool left = sah_bin(centroid(ref.aabb)[axis], centroid_bounds.min[axis], extent) < object_split.split;
+                (left ? left_refs : right_refs).push_back(ref);
+            }
+            node->axis = axis;
+        } else {
+            // Centroïdes confondus (ou arbre trop profond) : séparation à la médiane, comme la SAH.
+            int axis = 0;
+            double3 extent = centroid_bounds.max - centroid_bounds.min;
+            if (extent.y > extent[axis]) axis = 1;
+            if (extent.z > extent[axis]) axis = 2;
+
+            int mid = count / 2;
+            std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                             [=](const BVHObjectInfo& a, const BVHObjectInfo& b) {
+                                 return centroid(a.aabb)[axis] < centroid(b.aabb)[axis];
+                             });
+            left_refs.assign(refs.begin(), refs.begin() + mid);
+            right_refs.assign(refs.begin() + mid, refs.end());
+            node->axis = axis;
+        }
+    }
+
+    state.budget -= duplicates;
+
+    // Les références du noeud ne servent plus : on libère la mémoire avant de descendre.
+    std::vector<BVHObjectInfo>().swap(refs);
+    node->left = recursive_build_sbvh(left_refs, depth + 1, leaf_width, state);
+    node->right = recursive_build_sbvh(right_refs, depth + 1, leaf_width, state);
+    node->idx = -1;
+    node->count = 0;
+
+    return node;
+}
+
+void BVHTree::set_bounds(LinearBVHNode& node, const AABB& aabb) {
+    // Arrondit les bornes vers l'extérieur afin que la boîte en float englobe la boîte en double.
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = static_cast<float>(aabb.min[axis]);
+        float hi = static_cast<float>(aabb.max[axis]);
+        if (lo > aabb.min[axis]) lo = std::nextafter(lo, -FLT_MAX);
+        if (hi < aabb.max[axis]) hi = std::nextafter(hi, FLT_MAX);
+        node.bounds_min[axis] = lo;
+        node.bounds_max[axis] = hi;
+    }
+}
+
+double BVHTree::sah_cost() const {
+    if (nodes.empty()) {
+        return 0;
+    }
+
+    auto area = [](const LinearBVHNode& node) {
+        double dx = node.bounds_max[0] - node.bounds_min[0];
+        double dy = node.bounds_max[1] - node.bounds_min[1];
+        double dz = node.bounds_max[2] - node.bounds_min[2];
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    };
+
+    double root_area = area(nodes[0]);
+    if (!(root_area > 0)) {
+        return 0;
+    }
+
+    double cost = 0;
+    for (const LinearBVHNode& node : nodes) {
+        double weight = area(node) / root_area;
+        cost += node.n_primitives > 0 ? weight * node.n_primitives : weight * BVH_TRAVERSAL_COST;
+    }
+    return cost;
+}
+
+int BVHTree::flatten(BVHNode* node) {
+    int inode = static_cast<int>(nodes.size());
+    nodes.push_back(LinearBVHNode{});
+    set_bounds(nodes[inode], node->aabb);
+
+    if (node->left == nullptr && node->right == nullptr) {
+        nodes[inode].primitives_offset = node->idx;
+        nodes[inode].n_primitives = static_cast<uint16_t>(node->count);
+    } else {
+        nodes[inode].axis = static_cast<uint8_t>(node->axis);
+        nodes[inode].n_primitives = 0;
+
+        // L'enfant de gauche est placé immédiatement après son parent.
+        flatten(node->left);
+        int iright = flatten(node->right);
+        nodes[inode].second_child_offset = iright;
+    }
+
+    return inode;
+}
+
+void BVHTree::delete_tree(BVHNode* node) {
+    if (node) {
+        delete_tree(node->left);
+        delete_tree(node->right);
+        delete node;
+    }
+}
@@ -0,0 +1,598 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+
+#include "basic.h"
+#include "aabb.h"
+#include "stats.h"
+
+class ThreadPool;
+
+// Structure contenant l'index et le AABB associé.
+// Pratique pour créer l'algorithme de BVH.
+struct BVHObjectInfo {
+    // Index de l'objet
+    int idx;
+
+    // AABB associé à l'objet
+    AABB aabb;
+};
+
+// Structure représentant chaque noeud dans l'arbre BVH
+struct BVHNode {
+    // Noeud de gauche
+    BVHNode* left;
+    // Noeud de droite
+    BVHNode* right;
+
+    // AABB englobant les deux neuds.
+    AABB aabb;
+
+    // Index du premier objet de la feuille dans la liste (réordonnée) des objets, -1 pour un noeud interne.
+    int idx;
+
+    // Nombre d'objets contenus dans la feuille (0 pour un noeud interne).
+    int count;
+
+    // Axe de séparation d'un noeud interne.
+    int axis;
+};
+
+// Noeud compact de l'arbre BVH aplati, stocké dans un tableau en ordre profondeur d'abord.
+// L'enfant de gauche suit immédiatement son parent ; seul l'indice de l'enfant de droite est stocké.
+// Les bornes sont en float (arrondies vers l'extérieur) afin que le noeud tienne sur 32 octets.
+struct alignas(32) LinearBVHNode {
+    float bounds_min[3];
+    float bounds_max[3];
+    union {
+        // Feuille : indice du premier objet dans la liste.
+        int32_t primitives_offset;
+        // Noeud interne : indice de l'enfant de droite dans le tableau.
+        int32_t second_child_offset;
+    };
+    // Nombre d'objets dans la feuille (0 pour un noeud interne).
+    uint16_t n_primitives;
+    // Axe de séparation du noeud interne.
+    uint8_t axis;
+    uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode doit occuper 32 octets");
+
+// Taille de la pile de traversée (sur la pile d'exécution).
+#define BVH_STACK_SIZE 64
+// Au-delà de cette profondeur, les constructions SAH et LBVH séparent à la médiane pour borner la hauteur
+// de l'arbre et garantir que la pile de traversée ne déborde pas.
+#define BVH_MAX_SAH_DEPTH 32
+
+// Stratégie de séparation utilisée lors de la construction du BVH.
+enum BVHSplitMethod {
+    // Médiane sur un axe choisi à tour de rôle, un objet par feuille.
+    SPLIT_MEDIAN,
+    // Heuristique d'aire de surface (SAH) évaluée sur des paniers (binning) pour chaque axe.
+    SPLIT_SAH,
+    // BVH linéaire : les centroïdes sont triés par code de Morton (tri par base) et chaque noeud
+    // sépare sa plage au bit le plus significatif qui diffère. Construction bien plus rapide,
+    // arbre de moindre qualité que SPLIT_SAH.
+    SPLIT_LBVH,
+    // SAH avec séparations spatiales (SBVH) : lorsque les enfants d'une séparation par objets se
+    // chevauchent trop, un plan peut couper les primitives qui le traversent ; leur référence est
+    // alors dupliquée dans les deux enfants, avec une boîte découpée de chaque côté.
+    SPLIT_SBVH,
+};
+
+// Découpage d'une primitive pour la construction SBVH : retourne la boîte de la partie de la
+// primitive idx comprise entre les plans axis = lo et axis = hi, intersectée avec box (boîte
+// actuelle de sa référence). Sans fonction de découpage, seule box est découpée.
+typedef std::function<AABB(int idx, const AABB& box, int axis, double lo, double hi)> BVHClipFn;
+
+// Codes de Morton de la construction LBVH : 10 bits par axe (30 bits, 4 passes de tri) et,
+// à partir de ce nombre de primitives, 21 bits par axe (63 bits, 8 passes).
+#define BVH_LBVH_WIDE_CODES_MIN 262144
+
+// Construction SBVH : les séparations spatiales ne sont évaluées que si le chevauchement des enfants
+// de la meilleure séparation par objets dépasse cette fraction de l'aire de la racine.
+#define BVH_SBVH_ALPHA 1e-5
+// Nombre de paniers spatiaux évalués par axe.
+#define BVH_SBVH_BINS 16
+// Budget de références : au plus cette fraction du nombre de primitives en références dupliquées.
+#define BVH_SBVH_REFERENCE_BUDGET 0.3
+
+// Nombre de paniers évalués par axe pour la construction SAH.
+#define BVH_SAH_BINS 12
+// Nombre maximal d'objets par feuille pour la construction SAH.
+#define BVH_MAX_LEAF_SIZE 4
+// Coût relatif d'une traversée de noeud par rapport à une intersection d'objet.
+#define BVH_TRAVERSAL_COST 0.125
+
+// En dessous de ce nombre de primitives, l'arbre est construit sur le fil appelant.
+#define BVH_PARALLEL_MIN_PRIMITIVES 4096
+// Un noeud d'au moins ce nombre de primitives construit son sous-arbre de gauche dans une tâche.
+#define BVH_PARALLEL_TASK_MIN 1024
+// Un noeud SAH d'au moins ce nombre de primitives répartit ses objets dans les paniers en parallèle.
+#define BVH_PARALLEL_BINNING_MIN 65536
+// Taille des morceaux d'objets traités par une tâche de répartition.
+#define BVH_BUILD_CHUNK_SIZE 16384
+
+// Bilan de la dernière construction d'un BVHTree.
+struct BVHBuildReport {
+    int primitives;
+    // Références dans les feuilles ; dépasse primitives lorsque la SBVH en a dupliqué.
+    int references;
+    int nodes;
+    // Nombre de fils utilisés (1 : construction séquentielle).
+    int threads;
+    // Sous-arbres construits dans une tâche.
+    int tasks;
+    // Noeuds dont la répartition dans les paniers a été faite en parallèle.
+    int parallel_binning_nodes;
+    // Arbre chargé du cache disque plutôt que construit (voir build_bvh_cached).
+    bool cached;
+    double milliseconds;
+
+    // Affiche le bilan sur une ligne.
+    void print(std::ostream& out) const;
+};
+
+// Test de la boîte d'un noeud aplati par la méthode des dalles (slabs), avec l'inverse de la
+// direction pré-calculé. Retourne vrai si [t_min, t_max] chevauche l'intervalle d'entrée/sortie.
+inline bool intersect_node(const LinearBVHNode& node, const double3& origin, const double3& inv_dir,
+                           const int dir_is_neg[3], double t_min, double t_max) {
+    const float* bounds[2] = {node.bounds_min, node.bounds_max};
+
+    for (int axis = 0; axis < 3; axis++) {
+        double t0 = (bounds[dir_is_neg[axis]][axis] - origin[axis]) * inv_dir[axis];
+        double t1 = (bounds[1 - dir_is_neg[axis]][axis] - origin[axis]) * inv_dir[axis];
+        // Les comparaisons sont écrites pour que les NaN (0 * inf) ne rétrécissent pas l'intervalle.
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_min > t_max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bornes, par intervalles, des origines et des inverses de direction d'un paquet de rayons.
+// Un paquet n'est cohérent que si toutes ses directions ont le même signe (non nul) sur chaque axe ;
+// sinon les intervalles d'inverses seraient non bornés et le paquet est traité rayon par rayon.
+struct PacketBounds {
+    double origin_lo[3], origin_hi[3];
+    double inv_lo[3], inv_hi[3];
+    int dir_is_neg[3];
+};
+
+// Calcule les bornes d'un paquet. Retourne false si le paquet diverge.
+inline bool compute_packet_bounds(const RayPacket& packet, PacketBounds* bounds) {
+    for (int axis = 0; axis < 3; axis++) {
+        double first = packet.rays[0].direction[axis];
+        if (!(first != 0)) {
+            return false;
+        }
+        bounds->dir_is_neg[axis] = first < 0;
+        bounds->origin_lo[axis] = bounds->origin_hi[axis] = packet.rays[0].origin[axis];
+        bounds->inv_lo[axis] = bounds->inv_hi[axis] = 1.0 / first;
+
+        for (int iray = 1; iray < packet.count; iray++) {
+            double d = packet.rays[iray].direction[axis];
+            if (!(d != 0) || (d < 0) != (first < 0)) {
+                return false;
+            }
+            double o = packet.rays[iray].origin[axis];
+            bounds->origin_lo[axis] = std::min(bounds->origin_lo[axis], o);
+            bounds->origin_hi[axis] = std::max(bounds->origin_hi[axis], o);
+            bounds->inv_lo[axis] = std::min(bounds->inv_lo[axis], 1.0 / d);
+            bounds->inv_hi[axis] = std::max(bounds->inv_hi[axis], 1.0 / d);
+        }
+    }
+    return true;
+}
+
+// Test conservateur d'un noeud pour tout un paquet, par arithmétique d'intervalles.
+// Pour chaque axe, la distance d'entrée de chaque rayon appartient à (borne - [o_lo,o_hi]) * [inv_lo,inv_hi] ;
+// si l'intervalle de toutes les entrées possibles dépasse celui de toutes les sorties possibles,
+// aucun rayon du paquet ne peut toucher la boîte.
+inline bool intersect_node_packet(const LinearBVHNode& node, const PacketBounds& packet,
+                                  double t_min, double t_max) {
+    const float* bounds[2] = {node.bounds_min, node.bounds_max};
+
+    for (int axis = 0; axis < 3; axis++) {
+        double near_plane = bounds[packet.dir_is_neg[axis]][axis];
+        double far_plane = bounds[1 - packet.dir_is_neg[axis]][axis];
+
+        // Produits d'intervalles : les extrêmes sont atteints aux coins.
+        double n0 = (near_plane - packet.origin_hi[axis]) * packet.inv_lo[axis];
+        double n1 = (near_plane - packet.origin_hi[axis]) * packet.inv_hi[axis];
+        double n2 = (near_plane - packet.origin_lo[axis]) * packet.inv_lo[axis];
+        double n3 = (near_plane - packet.origin_lo[axis]) * packet.inv_hi[axis];
+        double f0 = (far_plane - packet.origin_hi[axis]) * packet.inv_lo[axis];
+        double f1 = (far_plane - packet.origin_hi[axis]) * packet.inv_hi[axis];
+        double f2 = (far_plane - packet.origin_lo[axis]) * packet.inv_lo[axis];
+        double f3 = (far_plane - packet.origin_lo[axis]) * packet.inv_hi[axis];
+
+        t_min = std::max(t_min, std::min(std::min(n0, n1), std::min(n2, n3)));
+        t_max = std::min(t_max, std::max(std::max(f0, f1), std::max(f2, f3)));
+        if (t_min > t_max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Arbre BVH aplati sur des primitives quelconques référencées par indice.
+// Sert à la fois au BVH de la scène (objets) et au BVH local de chaque Mesh (triangles).
+class BVHTree {
+public:
+    // Arbre aplati ; nodes[0] est la racine.
+    std::vector<LinearBVHNode> nodes;
+
+    // Bilan de la dernière construction.
+    BVHBuildReport report = {};
+
+    // Construit l'arbre à partir des boîtes des primitives.
+    // infos est réordonné sur place : une feuille couvre la plage [primitives_offset, +n_primitives)
+    // de infos, et infos[i].idx donne l'indice d'origine de la primitive.
+    // leaf_width est le nombre de primitives testées d'un seul coup (noyau SIMD) : la SAH compte
+    // alors le coût d'une feuille par groupe de leaf_width, et une feuille peut en contenir autant.
+    // Avec un pool de plus d'un participant et au moins BVH_PARALLEL_MIN_PRIMITIVES primitives,
+    // les sous-arbres sont construits en tâches sur ce pool et la répartition SAH des noeuds
+    // du haut de l'arbre est découpée en morceaux. Les sous-arbres couvrent des plages disjointes
+    // de infos : l'arbre obtenu est identique à celui d'une construction séquentielle.
+    // Avec SPLIT_SBVH, infos est remplacé par les références des feuilles (primitives dupliquées,
+    // boîtes découpées par clip) ; cette construction est séquentielle, afin que la consommation
+    // du budget de références ne dépende pas de l'ordre d'exécution des tâches.
+    void build(std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width = 1, ThreadPool* pool = nullptr,
+               const BVHClipFn& clip = nullptr);
+
+    bool empty() const { return nodes.empty(); }
+
+    // Réajuste les boîtes de l'arbre de bas en haut, sans changer sa topologie ni ses feuilles
+    // (objets animés). leaf_bounds(first, count) retourne la boîte des primitives d'une feuille.
+    template <typename LeafBoundsFn>
+    void refit(LeafBoundsFn&& leaf_bounds);
+
+    // Coût SAH de l'arbre relatif à l'aire de la racine ; sa croissance après un refit mesure
+    // la dégradation de l'arbre.
+    double sah_cost() const;
+
+    // Parcours ordonné pour l'intersection la plus proche.
+    // L'enfant le plus proche selon le signe de la direction sur l'axe de séparation est visité en
+    // premier, et chaque intersection acceptée rétrécit t_max, ce qui élague les sous-arbres situés
+    // derrière l'intersection courante.
+    //
+    // leaf(first, count, &closest) intersecte les primitives de la feuille dans [t_min, closest],
+    // met closest à jour et retourne vrai s'il y a eu une intersection.
+    template <typename LeafFn>
+    bool intersect(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const;
+
+    // Même parcours, mais on s'arrête dès que leaf(first, count) retourne vrai.
+    template <typename LeafFn>
+    bool occluded(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const;
+
+    // Parcours d'un paquet de rayons : chaque noeud interne n'est testé qu'une fois pour tout le paquet.
+    // Aux feuilles, seuls les rayons dont la boîte est réellement touchée appellent
+    // leaf(first, count, iray, &closest[iray]), comme dans intersect() ; le résultat de chaque rayon est
+    // donc identique à celui d'un parcours individuel. closest contient t_max en entrée.
+    // Un paquet divergent est parcouru rayon par rayon.
+    template <typename LeafFn>
+    void intersect_packet(const RayPacket& packet, double* closest, bool* hit_found, LeafFn&& leaf) const;
+
+    // Requête d'occlusion pour un paquet ; leaf(first, count, iray) retourne vrai si le rayon est bloqué.
+    // Les rayons bloqués quittent le paquet, et le parcours s'arrête lorsqu'ils le sont tous.
+    template <typename LeafFn>
+    void occluded_packet(const RayPacket& packet, bool* occluded, LeafFn&& leaf) const;
+
+private:
+    // État partagé par les tâches d'une construction (voir bvh.cpp).
+    struct BuildContext;
+
+    // Fonction recursive permettant la construction de notre arbre BVH
+    // On choisit aléatoirement un axe. On trie la liste en fonction de l'axe.
+    // On construit récursivement les autres noeuds également.
+    // On combine le AABB des deux noeuds après récursions.
+    static BVHNode* recursive_build(std::vector<BVHObjectInfo>& bvhs, int idx_start, int idx_end, int axis,
+                                    BuildContext& ctx);
+
+    // Construction récursive selon l'heuristique d'aire de surface.
+    // Pour chaque axe, les centroïdes sont répartis dans BVH_SAH_BINS paniers et le coût
+    // de chaque séparation entre paniers est évalué. La meilleure séparation (axe, panier)
+    // partitionne bvhs sur place ; on crée une feuille si elle est moins coûteuse.
+    static BVHNode* recursive_build_sah(std::vector<BVHObjectInfo>& bvhs, int idx_start, int idx_end, int depth,
+                                        int leaf_width, BuildContext& ctx);
+
+    // État de la construction SBVH (voir bvh.cpp).
+    struct SBVHState;
+
+    // Construction SBVH sur les références refs ; les feuilles ajoutent leurs références à la sortie.
+    static BVHNode* recursive_build_sbvh(std::vector<BVHObjectInfo>& refs, int depth, int leaf_width, SBVHState& state);
+
+    // Construction LBVH sur bvhs[idx_start, idx_end), déjà trié par codes (croissants).
+    static BVHNode* recursive_build_lbvh(std::vector<BVHObjectInfo>& bvhs, const std::vector<uint64_t>& codes,
+                                         int idx_start, int idx_end, int depth, int max_leaf_size, BuildContext& ctx);
+
+    // Construit left et right ; left dans une tâche si le noeud couvre assez de primitives.
+    template <typename LeftFn, typename RightFn>
+    static void build_children(int count, BuildContext& ctx, LeftFn&& left, RightFn&& right);
+
+    // Copie aabb dans les bornes en float du noeud, arrondies vers l'extérieur.
+    static void set_bounds(LinearBVHNode& node, const AABB& aabb);
+
+    // Aplatit l'arbre de pointeurs dans nodes en ordre profondeur d'abord.
+    // Retourne l'indice du noeud créé.
+    int flatten(BVHNode* node);
+
+    // Relâche récursivement les noeuds de l'arbre.
+    static void delete_tree(BVHNode* node);
+};
+
+template <typename LeafBoundsFn>
+void BVHTree::refit(LeafBoundsFn&& leaf_bounds) {
+    // Les enfants sont rangés après leur parent : un parcours à rebours les visite en premier.
+    for (int inode = static_cast<int>(nodes.size()) - 1; inode >= 0; inode--) {
+        LinearBVHNode& node = nodes[inode];
+        if (node.n_primitives > 0) {
+            set_bounds(node, leaf_bounds(node.primitives_offset, node.n_primitives));
+            continue;
+        }
+
+        // Les bornes des enfants sont déjà arrondies : leur union l'est aussi.
+        const LinearBVHNode& left = nodes[inode + 1];
+        const LinearBVHNode& right = nodes[node.second_child_offset];
+        for (int axis = 0; axis < 3; axis++) {
+            node.bounds_min[axis] = std::min(left.bounds_min[axis], right.bounds_min[axis]);
+            node.bounds_max[axis] = std::max(left.bounds_max[axis], right.bounds_max[axis]);
+        }
+    }
+}
+
+template <typename LeafFn>
+bool BVHTree::intersect(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    double3 inv_dir = 1.0 / ray.direction;
+    int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+
+    // Pile de taille fixe : aucune allocation par rayon.
+    int nodes_to_visit[BVH_STACK_SIZE];
+    int stack_size = 0;
+    int inode = 0;
+
+    // Borne supérieure courante : la profondeur de l'intersection la plus proche trouvée.
+    double closest = t_max;
+    bool hit_found = false;
+
+    while (true) {
+        const LinearBVHNode& node = nodes[inode];
+
+        if (intersect_node(node, ray.origin, inv_dir, dir_is_neg, t_min, closest)) {
+            STAT_ADD(STAT_BVH_NODES_VISITED, 1);
+
+            if (node.n_primitives > 0) {
+                // Feuille : intersection avec la géométrie, en rétrécissant l'intervalle.
+                if (leaf(node.primitives_offset, node.n_primitives, &closest)) {
+                    hit_found = true;
+                }
+            } else {
+                // Noeud interne : on descend d'abord dans l'enfant le plus proche.
+                // L'enfant de gauche est stocké juste après son parent.
+                if (dir_is_neg[node.axis]) {
+                    nodes_to_visit[stack_size++] = inode + 1;
+                    inode = node.second_child_offset;
+                } else {
+                    nodes_to_visit[stack_size++] = node.second_child_offset;
+                    inode = inode + 1;
+                }
+                continue;
+            }
+        } else {
+#if RAY_STATS
+            // Distingue les noeuds manqués de ceux élagués grâce à une intersection plus proche.
+            if (closest < t_max && intersect_node(node, ray.origin, inv_dir, dir_is_neg, t_min, t_max)) {
+                STAT_ADD(STAT_BVH_NODES_PRUNED, 1);
+                STAT_ADD(STAT_BVH_PRIMITIVES_PRUNED, node.n_primitives);
+            } else {
+                STAT_ADD(STAT_BVH_NODES_MISSED, 1);
+            }
+#endif
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        inode = nodes_to_visit[--stack_size];
+    }
+    return hit_found;
+}
+
+template <typename LeafFn>
+bool BVHTree::occluded(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    double3 inv_dir = 1.0 / ray.direction;
+    int dir_is_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+
+    int nodes_to_visit[BVH_STACK_SIZE];
+    int stack_size = 0;
+    int inode = 0;
+
+    while (true) {
+        const LinearBVHNode& node = nodes[inode];
+
+        if (intersect_node(node, ray.origin, inv_dir, dir_is_neg, t_min, t_max)) {
+            STAT_ADD(STAT_BVH_NODES_VISITED, 1);
+
+            if (node.n_primitives > 0) {
+                if (leaf(node.primitives_offset, node.n_primitives)) {
+                    return true;
+                }
+            } else {
+                if (dir_is_neg[node.axis]) {
+                    nodes_to_visit[stack_size++] = inode + 1;
+                    inode = node.second_child_offset;
+                } else {
+                    nodes_to_visit[stack_size++] = node.second_child_offset;
+                    inode = inode + 1;
+                }
+                continue;
+            }
+        } else {
+            STAT_ADD(STAT_BVH_NODES_MISSED, 1);
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        inode = nodes_to_visit[--stack_size];
+    }
+    return false;
+}
+
+template <typename LeafFn>
+void BVHTree::intersect_packet(const RayPacket& packet, double* closest, bool* hit_found, LeafFn&& leaf) const {
+    for (int iray = 0; iray < packet.count; iray++) {
+        hit_found[iray] = false;
+    }
+    if (nodes.empty() || packet.count == 0) {
+        return;
+    }
+
+    PacketBounds bounds{};
+    if (!compute_packet_bounds(packet, &bounds)) {
+        STAT_ADD(STAT_PACKET_FALLBACKS, 1);
+        for (int iray = 0; iray < packet.count; iray++) {
+            hit_found[iray] = intersect(packet.rays[iray], packet.t_min, closest[iray],
+                                        [&](int first, int count, double* ray_closest) {
+                                            return leaf(first, count, iray, ray_closest);
+                                        });
+        }
+        return;
+    }
+
+    double3 inv_dir[PACKET_MAX_RAYS];
+    for (int iray = 0; iray < packet.count; iray++) {
+        inv_dir[iray] = 1.0 / packet.rays[iray].direction;
+    }
+
+    // Le paquet peut être élagué dès que le noeud est derrière l'intersection la plus éloignée du paquet.
+    auto packet_t_max = [&]() {
+        double t = closest[0];
+        for (int iray = 1; iray < packet.count; iray++) {
+            t = std::max(t, closest[iray]);
+        }
+        return t;
+    };
+    double t_max = packet_t_max();
+
+    int nodes_to_visit[BVH_STACK_SIZE];
+    int stack_size = 0;
+    int inode = 0;
+
+    while (true) {
+        const LinearBVHNode& node = nodes[inode];
+
+        if (intersect_node_packet(node, bounds, packet.t_min, t_max)) {
+            STAT_ADD(STAT_PACKET_NODES_VISITED, 1);
+
+            if (node.n_primitives > 0) {
+                for (int iray = 0; iray < packet.count; iray++) {
+                    if (intersect_node(node, packet.rays[iray].origin, inv_dir[iray], bounds.dir_is_neg,
+                                       packet.t_min, closest[iray]) &&
+                        leaf(node.primitives_offset, node.n_primitives, iray, &closest[iray])) {
+                        hit_found[iray] = true;
+                    }
+                }
+                t_max = packet_t_max();
+            } else {
+                // Tous les rayons ont les mêmes signes : l'ordre avant-arrière est commun au paquet.
+                if (bounds.dir_is_neg[node.axis]) {
+                    nodes_to_visit[stack_size++] = inode + 1;
+                    inode = node.second_child_offset;
+                } else {
+                    nodes_to_visit[stack_size++] = node.second_child_offset;
+                    inode = inode + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        inode = nodes_to_visit[--stack_size];
+    }
+}
+
+template <typename LeafFn>
+void BVHTree::occluded_packet(const RayPacket& packet, bool* occluded, LeafFn&& leaf) const {
+    for (int iray = 0; iray < packet.count; iray++) {
+        occluded[iray] = false;
+    }
+    if (nodes.empty() || packet.count == 0) {
+        return;
+    }
+
+    PacketBounds bounds{};
+    if (!compute_packet_bounds(packet, &bounds)) {
+        STAT_ADD(STAT_PACKET_FALLBACKS, 1);
+        for (int iray = 0; iray < packet.count; iray++) {
+            occluded[iray] = this->occluded(packet.rays[iray], packet.t_min, packet.t_max[iray],
+                                            [&](int first, int count) { return leaf(first, count, iray); });
+        }
+        return;
+    }
+
+    double3 inv_dir[PACKET_MAX_RAYS];
+    double t_max = packet.t_max[0];
+    for (int iray = 0; iray < packet.count; iray++) {
+        inv_dir[iray] = 1.0 / packet.rays[iray].direction;
+        t_max = std::max(t_max, packet.t_max[iray]);
+    }
+    int remaining = packet.count;
+
+    int nodes_to_visit[BVH_STACK_SIZE];
+    int stack_size = 0;
+    int inode = 0;
+
+    while (true) {
+        const LinearBVHNode& node = nodes[inode];
+
+        if (intersect_node_packet(node, bounds, packet.t_min, t_max)) {
+            STAT_ADD(STAT_PACKET_NODES_VISITED, 1);
+
+            if (node.n_primitives > 0) {
+                for (int iray = 0; iray < packet.count; iray++) {
+                    if (!occluded[iray] &&
+                        intersect_node(node, packet.rays[iray].origin, inv_dir[iray], bounds.dir_is_neg,
+                                       packet.t_min, packet.t_max[iray]) &&
+                        leaf(node.primitives_offset, node.n_primitives, iray)) {
+                        occluded[iray] = true;
+                        if (--remaining == 0) {
+                            return;
+                        }
+                    }
+                }
+            } else {
+                if (bounds.dir_is_neg[node.axis]) {
+                    nodes_to_visit[stack_size++] = inode + 1;
+                    inode = node.second_child_offset;
+                } else {
+                    nodes_to_visit[stack_size++] = node.second_child_offset;
+                    inode = inode + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0) {
+            break;
+        }
+        inode = nodes_to_visit[--stack_size];
+    }
+}
@@ -0,0 +1,203 @@
+#include "bvh4.h"
+
+#include <cfloat>
+#include <limits>
+
+#if RAY_HAS_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+void BVH4Tree::build(const BVHTree& binary) {
+    nodes.clear();
+    if (binary.empty()) {
+        return;
+    }
+    collapse(binary, 0);
+}
+
+int BVH4Tree::collapse(const BVHTree& binary, int ibinary) {
+    auto is_leaf = [&](int inode) { return binary.nodes[inode].n_primitives > 0; };
+    auto area = [&](int inode) {
+        const LinearBVHNode& node = binary.nodes[inode];
+        AABB aabb{double3{node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]},
+                  double3{node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]}};
+        return surface_area(aabb);
+    };
+
+    // Enfants du noeud large : on ouvre d'abord l'enfant interne de plus grande aire,
+    // jusqu'à en avoir BVH4_WIDTH. Une racine feuille reste un seul enfant.
+    int children[BVH4_WIDTH];
+    int num_children = 0;
+    if (is_leaf(ibinary)) {
+        children[num_children++] = ibinary;
+    } else {
+        children[num_children++] = ibinary + 1;
+        children[num_children++] = binary.nodes[ibinary].second_child_offset;
+    }
+    while (num_children < BVH4_WIDTH) {
+        int best = -1;
+        double best_area = -1;
+        for (int i = 0; i < num_children; i++) {
+            if (!is_leaf(children[i]) && area(children[i]) > best_area) {
+                best = i;
+                best_area = area(children[i]);
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        int opened = children[best];
+        children[best] = opened + 1;
+        children[num_children++] = binary.nodes[opened].second_child_offset;
+    }
+
+    int inode = static_cast<int>(nodes.size());
+    nodes.push_back(BVH4Node{});
+    nodes[inode].num_children = static_cast<uint8_t>(num_children);
+
+    for (int ichild = 0; ichild < BVH4_WIDTH; ichild++) {
+        // Emplacement vide : boîte inversée, qu'aucun rayon ne touche.
+        if (ichild >= num_children) {
+            for (int axis = 0; axis < 3; axis++) {
+                nodes[inode].bounds[0][axis][ichild] = std::numeric_limits<float>::infinity();
+                nodes[inode].bounds[1][axis][ichild] = -std::numeric_limits<float>::infinity();
+            }
+            nodes[inode].child[ichild] = -1;
+            nodes[inode].count[ichild] = 0;
+            continue;
+        }
+
+        const LinearBVHNode& child = binary.nodes[children[ichild]];
+        for (int axis = 0; axis < 3; axis++) {
+            nodes[inode].bounds[0][axis][ichild] = child.bounds_min[axis];
+            nodes[inode].bounds[1][axis][ichild] = child.bounds_max[axis];
+        }
+        if (child.n_primitives > 0) {
+            nodes[inode].child[ichild] = child.primitives_offset;
+            nodes[inode].count[ichild] = child.n_primitives;
+        } else {
+            // nodes peut être réalloué par l'appel récursif : on n'y garde pas de référence.
+            int iwide = collapse(binary, children[ichild]);
+            nodes[inode].child[ichild] = iwide;
+            nodes[inode].count[ichild] = 0;
+        }
+    }
+
+    return inode;
+}
+
+uint32_t intersect_node4(const BVH4Node& node, const BVH4Ray& ray, double t_min, double t_max, double* t_near) {
+    uint32_t mask = 0;
+    for (int ichild = 0; ichild < node.num_children; ichild++) {
+        double lo = t_min;
+        double hi = t_max;
+        bool hit = true;
+        for (int axis = 0; axis < 3 && hit; axis++) {
+            double t0 = (node.bounds[ray.dir_is_neg[axis]][axis][ichild] - ray.origin[axis]) * ray.inv_dir[axis];
+            double t1 = (node.bounds[1 - ray.dir_is_neg[axis]][axis][ichild] - ray.origin[axis]) * ray.inv_dir[axis];
+            lo = t0 > lo ? t0 : lo;
+            hi = t1 < hi ? t1 : hi;
+            hit = !(lo > hi);
+        }
+        t_near[ichild] = lo;
+        if (hit) {
+            mask |= 1u << ichild;
+        }
+    }
+    return mask;
+}
+
+uint32_t intersect_node4_packet(const BVH4Node& node, const PacketBounds& packet, double t_min, double t_max,
+                                double* t_near) {
+    uint32_t mask = 0;
+    for (int ichild = 0; ichild < node.num_children; ichild++) {
+        double lo = t_min;
+        double hi = t_max;
+        bool hit = true;
+        for (int axis = 0; axis < 3 && hit; axis++) {
+            double near_plane = node.bounds[packet.dir_is_neg[axis]][axis][ichild];
+            double far_plane = node.bounds[1 - packet.dir_is_neg[axis]][axis][ichild];
+
+            double n0 = (near_plane - packet.origin_hi[axis]) * packet.inv_lo[axis];
+            double n1 = (near_plane - packet.origin_hi[axis]) * packet.inv_hi[axis];
+            double n2 = (near_plane - packet.origin_lo[axis]) * packet.inv_lo[axis];
+            double n3 = (near_plane - packet.origin_lo[axis]) * packet.inv_hi[axis];
+            double f0 = (far_plane - packet.origin_hi[axis]) * packet.inv_lo[axis];
+            double f1 = (far_plane - packet.origin_hi[axis]) * packet.inv_hi[axis];
+            double f2 = (far_plane - packet.origin_lo[axis]) * packet.inv_lo[axis];
+            double f3 = (far_plane - packet.origin_lo[axis]) * packet.inv_hi[axis];
+
+            lo = std::max(lo, std::min(std::min(n0, n1), std::min(n2, n3)));
+            hi = std::min(hi, std::max(std::max(f0, f1), std::max(f2, f3)));
+            hit = !(lo > hi);
+        }
+        t_near[ichild] = lo;
+        if (hit) {
+            mask |= 1u << ichild;
+        }
+    }
+    return mask;
+}
+
+#if RAY_HAS_AVX2_KERNELS
+
+// Les bornes float sont converties exactement en double ; max_pd(t0, lo) et min_pd(t1, hi)
+// reproduisent "t0 > lo ? t0 : lo" et "t1 < hi ? t1 : hi" (y compris pour les NaN).
+RAY_TARGET_AVX2
+uint32_t intersect_node4_avx2(const BVH4Node& node, const BVH4Ray& ray, double t_min, double t_max, double* t_near) {
+    __m256d lo = _mm256_set1_pd(t_min);
+    __m256d hi = _mm256_set1_pd(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256d near_plane = _mm256_cvtps_pd(_mm_load_ps(node.bounds[ray.dir_is_neg[axis]][axis]));
+        __m256d far_plane = _mm256_cvtps_pd(_mm_load_ps(node.bounds[1 - ray.dir_is_neg[axis]][axis]));
+        __m256d origin = _mm256_set1_pd(ray.origin[axis]);
+        __m256d inv_dir = _mm256_set1_pd(ray.inv_dir[axis]);
+
+        __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(near_plane, origin), inv_dir);
+        __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(far_plane, origin), inv_dir);
+        lo = _mm256_max_pd(t0, lo);
+        hi = _mm256_min_pd(t1, hi);
+    }
+
+    _mm256_storeu_pd(t_near, lo);
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(lo, hi, _CMP_LE_OQ)));
+    return mask & ((1u << node.num_children) - 1);
+}
+
+// Mêmes produits d'intervalles qu'intersect_node4_packet ; l'ordre des opérandes de min_pd et max_pd
+// reproduit std::min et std::max (y compris pour les NaN).
+RAY_TARGET_AVX2
+uint32_t intersect_node4_packet_avx2(const BVH4Node& node, const PacketBounds& packet, double t_min, double t_max,
+                                     double* t_near) {
+    __m256d lo = _mm256_set1_pd(t_min);
+    __m256d hi = _mm256_set1_pd(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256d near_plane = _mm256_cvtps_pd(_mm_load_ps(node.bounds[packet.dir_is_neg[axis]][axis]));
+        __m256d far_plane = _mm256_cvtps_pd(_mm_load_ps(node.bounds[1 - packet.dir_is_neg[axis]][axis]));
+        __m256d origin_lo = _mm256_set1_pd(packet.origin_lo[axis]);
+        __m256d origin_hi = _mm256_set1_pd(packet.origin_hi[axis]);
+        __m256d inv_lo = _mm256_set1_pd(packet.inv_lo[axis]);
+        __m256d inv_hi = _mm256_set1_pd(packet.inv_hi[axis]);
+
+        __m256d near_hi = _mm256_sub_pd(near_plane, origin_hi);
+        __m256d near_lo = _mm256_sub_pd(near_plane, origin_lo);
+        __m256d far_hi = _mm256_sub_pd(far_plane, origin_hi);
+        __m256d far_lo = _mm256_sub_pd(far_plane, origin_lo);
+
+        __m256d n01 = _mm256_min_pd(_mm256_mul_pd(near_hi, inv_hi), _mm256_mul_pd(near_hi, inv_lo));
+        __m256d n23 = _mm256_min_pd(_mm256_mul_pd(near_lo, inv_hi), _mm256_mul_pd(near_lo, inv_lo));
+        __m256d f01 = _mm256_max_pd(_mm256_mul_pd(far_hi, inv_hi), _mm256_mul_pd(far_hi, inv_lo));
+        __m256d f23 = _mm256_max_pd(_mm256_mul_pd(far_lo, inv_hi), _mm256_mul_pd(far_lo, inv_lo));
+
+        lo = _mm256_max_pd(_mm256_min_pd(n23, n01), lo);
+        hi = _mm256_min_pd(_mm256_max_pd(f23, f01), hi);
+    }
+
+    _mm256_storeu_pd(t_near, lo);
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(lo, hi, _CMP_LE_OQ)));
+    return mask & ((1u << node.num_children) - 1);
+}
+
+#endif
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cfloat>
+
+#include "basic.h"
+#include "bvh.h"
+#include "simd.h"
+#include "stats.h"
+
+// Nombre d'enfants d'un noeud du BVH large.
+#define BVH4_WIDTH 4
+// Taille de la pile de traversée : au plus BVH4_WIDTH - 1 enfants en attente par niveau.
+#define BVH4_STACK_SIZE 256
+
+// Noeud du BVH large : les boîtes des quatre enfants sont rangées en structure de tableaux
+// (bounds[min/max][axe][enfant]) afin qu'un seul test de dalles SIMD les évalue toutes.
+// Les bornes sont en float, arrondies vers l'extérieur comme celles de LinearBVHNode.
+struct alignas(64) BVH4Node {
+    float bounds[2][3][BVH4_WIDTH];
+    // Enfant interne : indice du noeud ; feuille : indice de la première primitive.
+    int32_t child[BVH4_WIDTH];
+    // Nombre de primitives d'un enfant feuille (0 pour un enfant interne).
+    uint16_t count[BVH4_WIDTH];
+    // Nombre d'enfants utilisés ; les emplacements suivants ont une boîte vide.
+    uint8_t num_children;
+};
+static_assert(sizeof(BVH4Node) == 128, "BVH4Node doit occuper deux lignes de cache");
+
+// Rayon préparé pour le test de dalles : inverse de la direction pré-calculé.
+struct BVH4Ray {
+    double origin[3];
+    double inv_dir[3];
+    int dir_is_neg[3];
+
+    BVH4Ray() {}
+    explicit BVH4Ray(const Ray& ray) {
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis] = ray.origin[axis];
+            inv_dir[axis] = 1.0 / ray.direction[axis];
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+        }
+    }
+};
+
+// Teste les enfants d'un noeud avec le rayon dans [t_min, t_max]. Retourne le masque des enfants
+// touchés et leur distance d'entrée dans t_near. Les opérations sont celles d'intersect_node,
+// enfant par enfant : le résultat est identique à celui du BVH binaire.
+uint32_t intersect_node4(const BVH4Node& node, const BVH4Ray& ray, double t_min, double t_max, double* t_near);
+#if RAY_HAS_AVX2_KERNELS
+RAY_TARGET_AVX2
+uint32_t intersect_node4_avx2(const BVH4Node& node, const BVH4Ray& ray, double t_min, double t_max, double* t_near);
+#endif
+
+// Test conservateur des enfants d'un noeud pour tout un paquet, par les mêmes produits d'intervalles
+// qu'intersect_node_packet. Retourne le masque des enfants que le paquet peut toucher et, dans t_near,
+// la plus petite entrée possible d'un rayon du paquet dans chacun.
+uint32_t intersect_node4_packet(const BVH4Node& node, const PacketBounds& packet, double t_min, double t_max,
+                                double* t_near);
+#if RAY_HAS_AVX2_KERNELS
+RAY_TARGET_AVX2
+uint32_t intersect_node4_packet_avx2(const BVH4Node& node, const PacketBounds& packet, double t_min, double t_max,
+                                     double* t_near);
+#endif
+
+// BVH large (4 enfants par noeud) obtenu en effondrant un BVHTree binaire : les feuilles, et donc
+// l'ordre des primitives, sont celles de l'arbre binaire.
+// Chaque étape de la traversée teste les quatre boîtes d'un coup (AVX2 si actif) et visite les
+// enfants touchés du plus proche au plus éloigné.
+class BVH4Tree {
+public:
+    // Arbre aplati ; nodes[0] est la racine.
+    std::vector<BVH4Node> nodes;
+
+    // Construit l'arbre large à partir d'un arbre binaire déjà construit.
+    void build(const BVHTree& binary);
+
+    bool empty() const { return nodes.empty(); }
+
+    // Mêmes contrats que BVHTree::intersect et BVHTree::occluded.
+    template <typename LeafFn>
+    bool intersect(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const;
+
+    template <typename LeafFn>
+    bool occluded(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const;
+
+    // Mêmes contrats que BVHTree::intersect_packet et BVHTree::occluded_packet : chaque boîte est
+    // testée une fois pour tout le paquet (arithmétique d'intervalles), puis rayon par rayon aux feuilles.
+    template <typename LeafFn>
+    void intersect_packet(const RayPacket& packet, double* closest, bool* hit_found, LeafFn&& leaf) const;
+
+    template <typename LeafFn>
+    void occluded_packet(const RayPacket& packet, bool* occluded, LeafFn&& leaf) const;
+
+private:
+    // Entrée de la pile de traversée : un noeud (count == 0) ou une feuille, avec sa distance d'entrée.
+    struct StackEntry {
+        double t_near;
+        int32_t child;
+        uint16_t count;
+    };
+
+    // Test des enfants selon le niveau SIMD actif.
+    static uint32_t test_children(const BVH4Node& node, const BVH4Ray& ray, double t_min, double t_max,
+                                  double* t_near) {
+#if RAY_HAS_AVX2_KERNELS
+        if (Simd::active() == SIMD_AVX2) {
+            return intersect_node4_avx2(node, ray, t_min, t_max, t_near);
+        }
+#endif
+        return intersect_node4(node, ray, t_min, t_max, t_near);
+    }
+
+    static uint32_t test_children_packet(const BVH4Node& node, const PacketBounds& packet, double t_min,
+                                         double t_max, double* t_near) {
+#if RAY_HAS_AVX2_KERNELS
+        if (Simd::active() == SIMD_AVX2) {
+            return intersect_node4_packet_avx2(node, packet, t_min, t_max, t_near);
+        }
+#endif
+        return intersect_node4_packet(node, packet, t_min, t_max, t_near);
+    }
+
+    // Parcours d'un paquet cohérent, un seul test d'intervalles par noeud pour ses quatre enfants.
+    // visit(node, leaves, num_leaves) traite les enfants feuilles que le paquet peut toucher, du plus
+    // proche au plus éloigné, et retourne false pour arrêter le parcours. *t_max est la borne du paquet,
+    // que visit peut rétrécir.
+    template <typename VisitFn>
+    void traverse_packet(const RayPacket& packet, const PacketBounds& bounds, const double* t_max,
+                         VisitFn&& visit) const;
+
+    // Crée le noeud large dont les enfants remplacent le noeud binaire ibinary. Retourne son indice.
+    int collapse(const BVHTree& binary, int ibinary);
+};
+
+template <typename LeafFn>
+bool BVH4Tree::intersect(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    BVH4Ray slab(ray);
+    StackEntry stack[BVH4_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = {t_min, 0, 0};
+
+    double closest = t_max;
+    bool hit_found = false;
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // L'enfant a été touché avant que closest ne rétrécisse ; le test de sa boîte avec la borne
+        // courante échoue exactement lorsque son entrée est au-delà.
+        if (entry.t_near > closest) {
+            STAT_ADD(STAT_BVH_NODES_PRUNED, 1);
+            STAT_ADD(STAT_BVH_PRIMITIVES_PRUNED, entry.count);
+            continue;
+        }
+
+        if (entry.count > 0) {
+            if (leaf(entry.child, entry.count, &closest)) {
+                hit_found = true;
+            }
+            continue;
+        }
+
+        const BVH4Node& node = nodes[entry.child];
+        double t_near[BVH4_WIDTH];
+        uint32_t mask = test_children(node, slab, t_min, closest, t_near);
+        STAT_ADD(STAT_BVH_NODES_VISITED, 1);
+
+        // Enfants touchés triés du plus éloigné au plus proche : le plus proche est dépilé en premier.
+        StackEntry hits[BVH4_WIDTH];
+        int num_hits = 0;
+        for (int ichild = 0; ichild < node.num_children; ichild++) {
+            if (mask & (1u << ichild)) {
+                StackEntry hit = {t_near[ichild], node.child[ichild], node.count[ichild]};
+                int pos = num_hits++;
+                while (pos > 0 && hits[pos - 1].t_near < hit.t_near) {
+                    hits[pos] = hits[pos - 1];
+                    pos--;
+                }
+                hits[pos] = hit;
+            }
+        }
+        STAT_ADD(STAT_BVH_NODES_MISSED, node.num_children - num_hits);
+        for (int i = 0; i < num_hits; i++) {
+            stack[stack_size++] = hits[i];
+        }
+    }
+    return hit_found;
+}
+
+template <typename LeafFn>
+bool BVH4Tree::occluded(const Ray& ray, double t_min, double t_max, LeafFn&& leaf) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    BVH4Ray slab(ray);
+    StackEntry stack[BVH4_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = {t_min, 0, 0};
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.count > 0) {
+            if (leaf(entry.child, entry.count)) {
+                return true;
+            }
+            continue;
+        }
+
+        const BVH4Node& node = nodes[entry.child];
+        double t_near[BVH4_WIDTH];
+        uint32_t mask = test_children(node, slab, t_min, t_max, t_near);
+        STAT_ADD(STAT_BVH_NODES_VISITED, 1);
+
+        for (int ichild = 0; ichild < node.num_children; ichild++) {
+            if (mask & (1u << ichild)) {
+                stack[stack_size++] = {t_near[ichild], node.child[ichild], node.count[ichild]};
+            } else {
+                STAT_ADD(STAT_BVH_NODES_MISSED, 1);
+            }
+        }
+    }
+    return false;
+}
+
+template <typename VisitFn>
+void BVH4Tree::traverse_packet(const RayPacket& packet, const PacketBounds& bounds, const double* t_max,
+                               VisitFn&& visit) const {
+    StackEntry stack[BVH4_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = {packet.t_min, 0, 0};
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // Aucun rayon du paquet n'entre dans le noeud avant la borne courante : son test échouerait.
+        if (entry.t_near > *t_max) {
+            continue;
+        }
+
+        const BVH4Node& node = nodes[entry.child];
+        double t_near[BVH4_WIDTH];
+        uint32_t mask = test_children_packet(node, bounds, packet.t_min, *t_max, t_near);
+
+        // Enfants touchés triés du plus proche au plus éloigné (entrée la plus précoce du paquet).
+        int order[BVH4_WIDTH];
+        int num_hits = 0;
+        for (int ichild = 0; ichild < node.num_children; ichild++) {
+            if (mask & (1u << ichild)) {
+                int pos = num_hits++;
+                while (pos > 0 && t_near[order[pos - 1]] > t_near[ichild]) {
+                    order[pos] = order[pos - 1];
+                    pos--;
+                }
+                order[pos] = ichild;
+            }
+        }
+        STAT_ADD(STAT_PACKET_NODES_VISITED, num_hits);
+
+        int leaves[BVH4_WIDTH];
+        int num_leaves = 0;
+        for (int i = 0; i < num_hits; i++) {
+            if (node.count[order[i]] > 0) {
+                leaves[num_leaves++] = order[i];
+            }
+        }
+        if (num_leaves > 0 && !visit(node, leaves, num_leaves)) {
+            return;
+        }
+
+        // Les noeuds internes touchés sont empilés du plus éloigné au plus proche.
+        for (int i = num_hits - 1; i >= 0; i--) {
+            int ichild = order[i];
+            if (node.count[ichild] == 0) {
+                stack[stack_size++] = {t_near[ichild], node.child[ichild], 0};
+            }
+        }
+    }
+}
+
+template <typename LeafFn>
+void BVH4Tree::intersect_packet(const RayPacket& packet, double* closest, bool* hit_found, LeafFn&& leaf) const {
+    for (int iray = 0; iray < packet.count; iray++) {
+        hit_found[iray] = false;
+    }
+    if (nodes.empty() || packet.count == 0) {
+        return;
+    }
+
+    PacketBounds bounds{};
+    if (!compute_packet_bounds(packet, &bounds)) {
+        STAT_ADD(STAT_PACKET_FALLBACKS, 1);
+        for (int iray = 0; iray < packet.count; iray++) {
+            hit_found[iray] = intersect(packet.rays[iray], packet.t_min, closest[iray],
+                                        [&](int first, int count, double* ray_closest) {
+                                            return leaf(first, count, iray, ray_closest);
+                                        });
+        }
+        return;
+    }
+
+    BVH4Ray rays[PACKET_MAX_RAYS];
+    double t_max = closest[0];
+    for (int iray = 0; iray < packet.count; iray++) {
+        rays[iray] = BVH4Ray(packet.rays[iray]);
+        t_max = std::max(t_max, closest[iray]);
+    }
+
+    traverse_packet(packet, bounds, &t_max, [&](const BVH4Node& node, const int* leaves, int num_leaves) {
+        // Un test des quatre boîtes par rayon ; comme dans intersect, une feuille touchée est écartée
+        // lorsque son entrée dépasse l'intersection trouvée entre-temps dans une feuille plus proche.
+        for (int iray = 0; iray < packet.count; iray++) {
+            double t_near[BVH4_WIDTH];
+            uint32_t mask = test_children(node, rays[iray], packet.t_min, closest[iray], t_near);
+            for (int i = 0; i < num_leaves; i++) {
+                int ichild = leaves[i];
+                if ((mask & (1u << ichild)) && !(t_near[ichild] > closest[iray]) &&
+                    leaf(node.child[ichild], node.count[ichild], iray, &closest[iray])) {
+                    hit_found[iray] = true;
+                }
+            }
+        }
+        // Le paquet est élagué derrière l'intersection la plus éloignée du paquet.
+        t_max = closest[0];
+        for (int iray = 1; iray < packet.count; iray++) {
+            t_max = std::max(t_max, closest[iray]);
+        }
+        return true;
+    });
+}
+
+template <typename LeafFn>
+void BVH4Tree::occluded_packet(const RayPacket& packet, bool* occluded, LeafFn&& leaf) const {
+    for (int iray = 0; iray < packet.count; iray++) {
+        occluded[iray] = false;
+    }
+    if (nodes.empty() || packet.count == 0) {
+        return;
+    }
+
+    PacketBounds bounds{};
+    if (!compute_packet_bounds(packet, &bounds)) {
+        STAT_ADD(STAT_PACKET_FALLBACKS, 1);
+        for (int iray = 0; iray < packet.count; iray++) {
+            occluded[iray] = this->occluded(packet.rays[iray], packet.t_min, packet.t_max[iray],
+                                            [&](int first, int count) { return leaf(first, count, iray); });
+        }
+        return;
+    }
+
+    BVH4Ray rays[PACKET_MAX_RAYS];
+    double t_max = packet.t_max[0];
+    for (int iray = 0; iray < packet.count; iray++) {
+        rays[iray] = BVH4Ray(packet.rays[iray]);
+        t_max = std::max(t_max, packet.t_max[iray]);
+    }
+    int remaining = packet.count;
+
+    traverse_packet(packet, bounds, &t_max, [&](const BVH4Node& node, const int* leaves, int num_leaves) {
+        for (int iray = 0; iray < packet.count; iray++) {
+            if (occluded[iray]) {
+                continue;
+            }
+            double t_near[BVH4_WIDTH];
+            uint32_t mask = test_children(node, rays[iray], packet.t_min, packet.t_max[iray], t_near);
+            for (int i = 0; i < num_leaves; i++) {
+                int ichild = leaves[i];
+                if ((mask & (1u << ichild)) && leaf(node.child[ichild], node.count[ichild], iray)) {
+                    occluded[iray] = true;
+                    if (--remaining == 0) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+        }
+        return true;
+    });
+}
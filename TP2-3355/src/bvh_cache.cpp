@@ -0,0 +1,196 @@
+#include "bvh_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<LinearBVHNode>::value, "LinearBVHNode est copié tel quel dans le cache");
+static_assert(sizeof(BVHCacheHeader) == 32, "BVHCacheHeader doit occuper 32 octets");
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t bvh_cache_key(const std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width,
+                       uint64_t geometry_hash) {
+    uint64_t hash = BVH_CACHE_HASH_SEED;
+    int32_t params[3] = {BVH_CACHE_VERSION, static_cast<int32_t>(method), leaf_width};
+    uint64_t count = infos.size();
+    hash = hash_bytes(hash, params, sizeof(params));
+    hash = hash_bytes(hash, &count, sizeof(count));
+    hash = hash_bytes(hash, &geometry_hash, sizeof(geometry_hash));
+
+    // Champ par champ : BVHObjectInfo contient du remplissage.
+    for (const BVHObjectInfo& info : infos) {
+        double bounds[6] = {info.aabb.min.x, info.aabb.min.y, info.aabb.min.z,
+                            info.aabb.max.x, info.aabb.max.y, info.aabb.max.z};
+        int32_t idx = info.idx;
+        hash = hash_bytes(hash, &idx, sizeof(idx));
+        hash = hash_bytes(hash, bounds, sizeof(bounds));
+    }
+    return hash;
+}
+
+std::string bvh_cache_path(const std::string& cache_dir, uint64_t key) {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+    return (std::filesystem::path(cache_dir) / name.str()).string();
+}
+
+bool load_bvh_cache(const std::string& cache_dir, uint64_t key, int leaf_width, BVHTree& tree,
+                    std::vector<BVHObjectInfo>& infos) {
+    // Lecture directe dans les tableaux de l'arbre : les noeuds doivent de toute façon être validés
+    // et les indices convertis en BVHObjectInfo, une projection en mémoire n'éviterait aucune copie.
+    std::ifstream in(bvh_cache_path(cache_dir, key), std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    BVHCacheHeader header;
+    if (file_size < sizeof(header) || !in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    if (header.magic != BVH_CACHE_MAGIC || header.version != BVH_CACHE_VERSION || header.key != key
+        || header.node_size != sizeof(LinearBVHNode) || header.num_primitives != infos.size()
+        || header.num_nodes == 0) {
+        return false;
+    }
+    uint64_t nodes_bytes = static_cast<uint64_t>(header.num_nodes) * sizeof(LinearBVHNode);
+    uint64_t refs_bytes = static_cast<uint64_t>(header.num_refs) * sizeof(int32_t);
+    if (file_size != sizeof(header) + nodes_bytes + refs_bytes) {
+        return false;
+    }
+
+    std::vector<LinearBVHNode> nodes(header.num_nodes);
+    std::vector<int32_t> indices(header.num_refs);
+    if (!in.read(reinterpret_cast<char*>(nodes.data()), nodes_bytes)
+        || !in.read(reinterpret_cast<char*>(indices.data()), refs_bytes)) {
+        return false;
+    }
+
+    // Un fichier tronqué ou corrompu ne doit pas produire d'accès hors des tableaux, ni à la traversée
+    // ni dans les paquets de primitives construits d'après les feuilles (au plus max_leaf_size par feuille).
+    // Les enfants suivent toujours leur parent : une seule passe suffit pour propager les profondeurs,
+    // bornées par la pile de traversée (BVH_STACK_SIZE).
+    uint32_t max_leaf_size = static_cast<uint32_t>(std::max(BVH_MAX_LEAF_SIZE, leaf_width));
+    std::vector<int> depths(header.num_nodes, 0);
+    for (uint32_t inode = 0; inode < header.num_nodes; inode++) {
+        const LinearBVHNode& node = nodes[inode];
+        if (node.n_primitives > 0) {
+            if (node.n_primitives > max_leaf_size || node.primitives_offset < 0
+                || static_cast<uint64_t>(node.primitives_offset) + node.n_primitives > header.num_refs) {
+                return false;
+            }
+        } else {
+            if (node.second_child_offset <= static_cast<int32_t>(inode) + 1
+                || static_cast<uint32_t>(node.second_child_offset) >= header.num_nodes
+                || depths[inode] + 1 >= BVH_STACK_SIZE) {
+                return false;
+            }
+            depths[inode + 1] = depths[node.second_child_offset] = depths[inode] + 1;
+        }
+    }
+
+    std::vector<BVHObjectInfo> refs(header.num_refs);
+    for (uint32_t iref = 0; iref < header.num_refs; iref++) {
+        int32_t idx = indices[iref];
+        if (idx < 0 || static_cast<uint32_t>(idx) >= header.num_primitives) {
+            return false;
+        }
+        refs[iref] = infos[idx];
+    }
+
+    tree.nodes.swap(nodes);
+    infos.swap(refs);
+    tree.report = {};
+    tree.report.primitives = static_cast<int>(header.num_primitives);
+    tree.report.references = static_cast<int>(header.num_refs);
+    tree.report.nodes = static_cast<int>(header.num_nodes);
+    tree.report.threads = 1;
+    tree.report.cached = true;
+    return true;
+}
+
+bool save_bvh_cache(const std::string& cache_dir, uint64_t key, const BVHTree& tree,
+                    const std::vector<BVHObjectInfo>& infos) {
+    if (tree.empty()) {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(cache_dir, error);
+    if (error) {
+        return false;
+    }
+
+    BVHCacheHeader header = {};
+    header.magic = BVH_CACHE_MAGIC;
+    header.version = BVH_CACHE_VERSION;
+    header.key = key;
+    header.node_size = sizeof(LinearBVHNode);
+    header.num_primitives = static_cast<uint32_t>(tree.report.primitives);
+    header.num_nodes = static_cast<uint32_t>(tree.nodes.size());
+    header.num_refs = static_cast<uint32_t>(infos.size());
+
+    std::vector<int32_t> indices;
+    indices.reserve(infos.size());
+    for (const BVHObjectInfo& info : infos) {
+        indices.push_back(info.idx);
+    }
+
+    // Écrit dans un fichier temporaire puis renomme : un rendu concurrent ne voit jamais un fichier partiel.
+    std::string path = bvh_cache_path(cache_dir, key);
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(tree.nodes.data()), tree.nodes.size() * sizeof(LinearBVHNode));
+        out.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(int32_t));
+        if (!out.good()) {
+            out.close();
+            std::filesystem::remove(tmp_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+    if (error) {
+        std::filesystem::remove(tmp_path, error);
+        return false;
+    }
+    return true;
+}
+
+bool build_bvh_cached(BVHTree& tree, std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width,
+                      ThreadPool* pool, const std::string& cache_dir, uint64_t geometry_hash,
+                      const BVHClipFn& clip) {
+    if (cache_dir.empty() || infos.empty()) {
+        tree.build(infos, method, leaf_width, pool, clip);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t key = bvh_cache_key(infos, method, leaf_width, geometry_hash);
+    if (load_bvh_cache(cache_dir, key, leaf_width, tree, infos)) {
+        tree.report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    tree.build(infos, method, leaf_width, pool, clip);
+    if (!save_bvh_cache(cache_dir, key, tree, infos)) {
+        std::cerr << "Unable to write BVH cache " << bvh_cache_path(cache_dir, key) << std::endl;
+    }
+    return false;
+}
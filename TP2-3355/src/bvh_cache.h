@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+
+// Version du format des fichiers de cache. À incrémenter à chaque changement du format, de
+// LinearBVHNode ou des constructions (paramètres SAH, SBVH, etc.) : les anciens fichiers sont ignorés.
+#define BVH_CACHE_VERSION 1
+// "BVHC" en petit-boutiste.
+#define BVH_CACHE_MAGIC 0x43485642u
+
+// En-tête d'un fichier de cache, suivi de num_nodes LinearBVHNode puis de num_refs indices int32
+// (BVHObjectInfo::idx des références, dans l'ordre des feuilles). Les données sont dans l'ordre
+// d'octets de la machine qui a écrit le fichier.
+struct BVHCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Clé de la construction (voir bvh_cache_key) ; le nom du fichier en est dérivé.
+    uint64_t key;
+    uint32_t node_size;
+    uint32_t num_primitives;
+    uint32_t num_nodes;
+    uint32_t num_refs;
+};
+
+// Hachage FNV-1a 64 bits de size octets, poursuivi à partir de hash.
+#define BVH_CACHE_HASH_SEED 0xcbf29ce484222325ull
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+
+// Clé d'une construction : la version du format, la méthode, la largeur des feuilles et les entrées
+// (indices et boîtes de infos, avant construction), plus geometry_hash pour ce que les boîtes ne
+// décrivent pas (p. ex. les triangles découpés par la SBVH). Deux constructions de même clé
+// produisent le même arbre.
+uint64_t bvh_cache_key(const std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width,
+                       uint64_t geometry_hash = 0);
+
+// Chemin du fichier de cache d'une clé dans le dossier cache_dir.
+std::string bvh_cache_path(const std::string& cache_dir, uint64_t key);
+
+// Charge tree et l'ordre des références depuis le fichier de la clé. infos contient les entrées
+// de la construction (l'indice i à la position i) ; il est remplacé par les références des feuilles,
+// avec les boîtes des primitives (non découpées). leaf_width est celle de la construction : une feuille
+// de plus de max(BVH_MAX_LEAF_SIZE, leaf_width) primitives rend le fichier invalide. Retourne faux,
+// sans rien modifier, si le fichier est absent, d'une autre version ou invalide.
+bool load_bvh_cache(const std::string& cache_dir, uint64_t key, int leaf_width, BVHTree& tree,
+                    std::vector<BVHObjectInfo>& infos);
+
+// Écrit tree et l'ordre des références infos dans le fichier de la clé (créé dans un fichier temporaire
+// puis renommé). Retourne faux si le fichier ne peut être écrit.
+bool save_bvh_cache(const std::string& cache_dir, uint64_t key, const BVHTree& tree,
+                    const std::vector<BVHObjectInfo>& infos);
+
+// BVHTree::build passant par le cache disque : charge l'arbre s'il existe un fichier pour ces entrées,
+// sinon le construit et l'écrit. Un cache_dir vide désactive le cache. Retourne vrai si l'arbre
+// a été chargé (tree.report.cached).
+bool build_bvh_cached(BVHTree& tree, std::vector<BVHObjectInfo>& infos, BVHSplitMethod method, int leaf_width,
+                      ThreadPool* pool, const std::string& cache_dir, uint64_t geometry_hash = 0,
+                      const BVHClipFn& clip = nullptr);
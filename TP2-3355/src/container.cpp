@@ -1,5 +1,35 @@
 #include "container.h"
-#include <stack>
+#include "bvh_cache.h"
+#include "stats.h"
+
+void BVH::build(ThreadPool* pool, const std::string& cache_dir) {
+    std::vector<BVHObjectInfo> bvhs;
+
+    for (int iobj = 0; iobj < objects.size(); iobj++) {
+        bvhs.push_back({iobj, objects[iobj]->compute_aabb()});
+    }
+
+    // Avec AVX2, une suite d'objets du même type est testée par paquet de PRIMITIVE_PACK_WIDTH :
+    // la SAH compte alors le coût d'une feuille par paquet.
+    build_bvh_cached(tree, bvhs, method, Simd::avx2_supported() ? PRIMITIVE_PACK_WIDTH : 1, pool, cache_dir);
+    built_cost = tree.sah_cost();
+
+    // Les feuilles référencent des plages contiguës de bvhs : les objets sont copiés dans cet ordre.
+    primitives.build(objects, bvhs, tree);
+}
+
+bool BVH::update(double rebuild_threshold) {
+    primitives.update_objects();
+    tree.refit([&](int first, int count) { return primitives.bounds(first, count); });
+
+    // Les objets ont trop bougé pour la topologie de l'arbre : on repart des objets de la scène.
+    if (tree.sah_cost() > rebuild_threshold * built_cost) {
+        ThreadPool pool(num_threads);
+        build(&pool);
+        return true;
+    }
+    return false;
+}
 
 // @@@@@@ VOTRE CODE ICI
 // - Parcourir l'arbre DEPTH FIRST SEARCH selon les conditions suivantes:
@@ -8,50 +38,123 @@
 //			- Faites l'intersection du rayon avec le AABB gauche et droite. 
 //				- S'il y a intersection, ajouter le noeud à ceux à visiter. 
 // - Retourner l'intersection avec la profondeur maximale la plus PETITE.
+//
+// Le parcours ordonné est fait par BVHTree::intersect ; on ne fournit ici que le test des feuilles.
 bool BVH::intersect(Ray ray, double t_min, double t_max, Intersection* hit) {
-	
-	// Initialize a stack for the nodes to visit.
-    std::stack<BVHNode*> nodes_to_visit;
-    // Start with the root node.
-    nodes_to_visit.push(root);
-
-    // Initialize the closest hit distance to the maximum possible value.
-    double3 closest_hit_distance = std::numeric_limits<double3>::max();
-    // Initialize a flag to indicate whether a hit was found.
-    bool hit_found = false;
+    STAT_ADD(STAT_CLOSEST_HIT_QUERIES, 1);
 
-    // While there are still nodes to visit, visit the next node.
-    while(!nodes_to_visit.empty()) {
-        BVHNode* node = nodes_to_visit.top();
-        nodes_to_visit.pop();
-
-        // If the node is a leaf, intersect the ray with the geometry.
-        if(node->left == nullptr && node->right == nullptr) {
-            Intersection temp_hit;
-            if(objects[node->idx]->intersect(ray, t_min, t_max, &temp_hit)) {
-                // If the intersection is closer than the closest hit found so far, update the closest hit.
-                if(temp_hit.position < closest_hit_distance) {
-                    closest_hit_distance = temp_hit.position;
-                    *hit = temp_hit;
-                    hit_found = true;
-                }
-            }
-        }
-        // Otherwise, the node is an internal node.
-        else {
-            // Intersect the ray with the left and right AABBs.
-            
-            bool hit_left = node->left->aabb.intersect(ray, t_min, t_max);
-            bool hit_right = node->right->aabb.intersect(ray, t_min, t_max);
-
-            // If there is an intersection, add the node to the nodes to visit.
-            if(hit_left) nodes_to_visit.push(node->left);
-            if(hit_right) nodes_to_visit.push(node->right);
+    // Seul l'enregistrement minimal est conservé pendant le parcours ; les attributs
+    // ne sont calculés que pour l'intersection la plus proche.
+    HitRecord record;
+    bool hit_found = tree.intersect(ray, t_min, t_max, [&](int first, int count, double* closest) {
+        return primitives.intersect(first, count, ray, t_min, closest, &record);
+    });
+
+    if (hit_found) {
+        record.object->resolve(ray, record, hit);
+    }
+    return hit_found;
+}
+
+// Même parcours que BVH::intersect, mais on retourne dès la première intersection.
+bool BVH::occluded(Ray ray, double t_min, double t_max) {
+    STAT_ADD(STAT_OCCLUSION_QUERIES, 1);
+
+    return tree.occluded(ray, t_min, t_max, [&](int first, int count) {
+        return primitives.occluded(first, count, ray, t_min, t_max);
+    });
+}
+
+// Un paquet est traversé ensemble ; chaque rayon ne teste que les feuilles que sa propre boîte touche.
+void BVH::intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found) {
+    STAT_ADD(STAT_PACKET_QUERIES, 1);
+    STAT_ADD(STAT_CLOSEST_HIT_QUERIES, packet.count);
+
+    double closest[PACKET_MAX_RAYS];
+    HitRecord records[PACKET_MAX_RAYS];
+    for (int iray = 0; iray < packet.count; iray++) {
+        closest[iray] = packet.t_max[iray];
+    }
+
+    tree.intersect_packet(packet, closest, hit_found, [&](int first, int count, int iray, double* ray_closest) {
+        return primitives.intersect(first, count, packet.rays[iray], packet.t_min, ray_closest, &records[iray]);
+    });
+
+    for (int iray = 0; iray < packet.count; iray++) {
+        if (hit_found[iray]) {
+            records[iray].object->resolve(packet.rays[iray], records[iray], &hits[iray]);
         }
     }
+}
+
+void BVH::occluded_packet(const RayPacket& packet, bool* occluded) {
+    STAT_ADD(STAT_PACKET_QUERIES, 1);
+    STAT_ADD(STAT_OCCLUSION_QUERIES, packet.count);
+
+    tree.occluded_packet(packet, occluded, [&](int first, int count, int iray) {
+        return primitives.occluded(first, count, packet.rays[iray], packet.t_min, packet.t_max[iray]);
+    });
+}
+
+// Même test des feuilles que BVH::intersect, mais parcours de l'arbre large.
+bool BVH4::intersect(Ray ray, double t_min, double t_max, Intersection* hit) {
+    STAT_ADD(STAT_CLOSEST_HIT_QUERIES, 1);
+
+    HitRecord record;
+    bool hit_found = wide.intersect(ray, t_min, t_max, [&](int first, int count, double* closest) {
+        return primitives.intersect(first, count, ray, t_min, closest, &record);
+    });
+
+    if (hit_found) {
+        record.object->resolve(ray, record, hit);
+    }
     return hit_found;
 }
 
+bool BVH4::occluded(Ray ray, double t_min, double t_max) {
+    STAT_ADD(STAT_OCCLUSION_QUERIES, 1);
+
+    return wide.occluded(ray, t_min, t_max, [&](int first, int count) {
+        return primitives.occluded(first, count, ray, t_min, t_max);
+    });
+}
+
+void BVH4::intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found) {
+    STAT_ADD(STAT_PACKET_QUERIES, 1);
+    STAT_ADD(STAT_CLOSEST_HIT_QUERIES, packet.count);
+
+    double closest[PACKET_MAX_RAYS];
+    HitRecord records[PACKET_MAX_RAYS];
+    for (int iray = 0; iray < packet.count; iray++) {
+        closest[iray] = packet.t_max[iray];
+    }
+
+    wide.intersect_packet(packet, closest, hit_found, [&](int first, int count, int iray, double* ray_closest) {
+        return primitives.intersect(first, count, packet.rays[iray], packet.t_min, ray_closest, &records[iray]);
+    });
+
+    for (int iray = 0; iray < packet.count; iray++) {
+        if (hit_found[iray]) {
+            records[iray].object->resolve(packet.rays[iray], records[iray], &hits[iray]);
+        }
+    }
+}
+
+void BVH4::occluded_packet(const RayPacket& packet, bool* occluded) {
+    STAT_ADD(STAT_PACKET_QUERIES, 1);
+    STAT_ADD(STAT_OCCLUSION_QUERIES, packet.count);
+
+    wide.occluded_packet(packet, occluded, [&](int first, int count, int iray) {
+        return primitives.occluded(first, count, packet.rays[iray], packet.t_min, packet.t_max[iray]);
+    });
+}
+
+bool BVH4::update(double rebuild_threshold) {
+    bool rebuilt = BVH::update(rebuild_threshold);
+    wide.build(tree);
+    return rebuilt;
+}
+
 // @@@@@@ VOTRE CODE ICI
 // - Parcourir tous les objets
 // 		- Détecter l'intersection avec l'AABB
@@ -61,15 +164,52 @@ bool BVH::intersect(Ray ray, double t_min, double t_max, Intersection* hit) {
 bool Naive::intersect(Ray ray, double t_min, double t_max, Intersection* hit) {
     bool hit_found = false;
     double closest_hit_distance = t_max;
+    HitRecord record;
+
+    STAT_ADD(STAT_CLOSEST_HIT_QUERIES, 1);
 
     for (auto& object : objects) {
-        Intersection temp_hit;
-        if (object->intersect(ray, t_min, closest_hit_distance, &temp_hit)) {
+        STAT_ADD(STAT_PRIMITIVES_TESTED, 1);
+        HitRecord temp_record;
+        if (object->intersect(ray, t_min, closest_hit_distance, &temp_record)) {
             hit_found = true;
-            closest_hit_distance = temp_hit.depth;
-            *hit = temp_hit;
+            closest_hit_distance = temp_record.depth;
+            record = temp_record;
         }
     }
+
+    if (hit_found) {
+        record.object->resolve(ray, record, hit);
+    }
     return hit_found;
 }
 
+
+
+bool Naive::occluded(Ray ray, double t_min, double t_max) {
+    STAT_ADD(STAT_OCCLUSION_QUERIES, 1);
+
+    for (auto& object : objects) {
+        STAT_ADD(STAT_PRIMITIVES_TESTED, 1);
+        if (object->occluded(ray, t_min, t_max)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Naive::update(double /*rebuild_threshold*/) {
+    return false;
+}
+
+void IContainer::intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found) {
+    for (int iray = 0; iray < packet.count; iray++) {
+        hit_found[iray] = intersect(packet.rays[iray], packet.t_min, packet.t_max[iray], &hits[iray]);
+    }
+}
+
+void IContainer::occluded_packet(const RayPacket& packet, bool* occluded) {
+    for (int iray = 0; iray < packet.count; iray++) {
+        occluded[iray] = this->occluded(packet.rays[iray], packet.t_min, packet.t_max[iray]);
+    }
+}
@@ -5,6 +5,10 @@
 #include "object.h"
 #include "basic.h"
 #include "aabb.h"
+#include "bvh.h"
+#include "bvh4.h"
+#include "primitive_store.h"
+#include "thread_pool.h"
 
 //Interface d'un container pour différente intersection.
 class IContainer {
@@ -14,88 +18,94 @@ public:
     // Intersecte le rayon avec l'ensemble des objets dans l'intervalle spécifiée.
     // Retourne vrai s'il y a intersection sinon faux.
 	virtual bool intersect(Ray ray, double t_min, double t_max, Intersection* hit) = 0;
-};
-
-// Structure contenant l'index et le AABB associé.
-// Pratique pour créer l'algorithme de BVH.
-struct BVHObjectInfo {
-    // Index de l'objet
-    int idx;
 
-    // AABB associé à l'objet
-    AABB aabb;
-};
+    // Détermine si un objet quelconque bloque le rayon dans l'intervalle spécifiée.
+    // S'arrête à la première intersection trouvée et ne calcule aucun attribut (rayons d'ombre).
+    virtual bool occluded(Ray ray, double t_min, double t_max) = 0;
 
-// Structure représentant chaque noeud dans l'arbre BVH
-struct BVHNode {
-    // Noeud de gauche
-    BVHNode* left;
-    // Noeud de droite
-    BVHNode* right;
+    // Intersecte chaque rayon du paquet ; hits[i] et hit_found[i] correspondent à packet.rays[i].
+    // Par défaut, les rayons sont traités un à un.
+    virtual void intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found);
 
-    // AABB englobant les deux neuds.
-    AABB aabb;
+    // Requête d'occlusion pour chaque rayon du paquet. Par défaut, les rayons sont traités un à un.
+    virtual void occluded_packet(const RayPacket& packet, bool* occluded);
 
-    // Index de l'objet dans la liste
-    int idx;
+    // Met la structure à jour après un changement des transformations des objets (animation).
+    // Retourne vrai si la structure a été reconstruite plutôt que réajustée.
+    virtual bool update(double rebuild_threshold) = 0;
 };
 
-// Classe contenant la liste d'objet et la racine de l'arbre BVH.
+// Classe contenant la liste d'objet et l'arbre BVH de la scène (niveau supérieur).
+// Les Mesh possèdent leur propre BVH local sur leurs triangles (niveau inférieur).
 class BVH : virtual public IContainer {
 public:
-    //Liste d'objets représentants tous les objets dans la scène.
-    std::vector<Object*> objects;
-
-    // Racine de l'arbre BVH
-    // NOTE UTILE: Si les valeurs de left et right sont nulles, il s'agit d'une feuille.
-    BVHNode* root;
+    // Copies des objets de la scène, par type, dans l'ordre des feuilles de l'arbre.
+    // Les feuilles sont testées par type (switch), sans appel virtuel par objet.
+    PrimitiveStore primitives;
 
-    //Constructeur de BVH qui appelle récursivement recursive_build afin de construire l'arbre.
-    BVH(std::vector<Object*> objs) : objects(objs) {
-        std::vector<BVHObjectInfo> bvhs;
+    // Arbre BVH aplati sur les objets.
+    BVHTree tree;
 
-        for (int iobj = 0; iobj < objects.size(); iobj++) {
-            bvhs.push_back({iobj, objects[iobj]->compute_aabb()});
-        }
-
-        root = recursive_build(bvhs, 0, bvhs.size(), 0);
+    // Objets de la scène, méthode et nombre de fils de la construction, conservés pour les
+    // reconstructions de update (primitives peut contenir des doublons avec SPLIT_SBVH).
+    std::vector<Object*> objects;
+    BVHSplitMethod method;
+    int num_threads;
+
+    // Coût SAH de l'arbre à sa dernière construction (voir update).
+    double built_cost;
+
+    //Constructeur de BVH qui construit l'arbre sur les boîtes englobantes globales des objets.
+    // pool : participants de la construction (voir BVHTree::build), nullptr pour une construction séquentielle.
+    // cache_dir : dossier du cache disque de l'arbre (voir build_bvh_cached) ; vide pour le désactiver.
+    BVH(std::vector<Object*> objects, BVHSplitMethod method = SPLIT_MEDIAN, ThreadPool* pool = nullptr,
+        const std::string& cache_dir = "")
+        : objects(objects), method(method), num_threads(pool ? pool->size() : 1) {
+        build(pool, cache_dir);
     };
     ~BVH() {};
 
     //À adapter pour BVH
 	bool intersect(Ray ray, double t_min, double t_max, Intersection* hit);
-private:
-
-    // Fonction recursive permettant la construction de notre arbre BVH
-    // On choisit aléatoirement un axe. On trie la liste en fonction de l'axe.
-    // On construit récursivement les autres noeuds également.
-    // On combine le AABB des deux noeuds après récursions.
-    BVHNode* recursive_build(std::vector<BVHObjectInfo> bvhs, int idx_start, int idx_end, int axis) {
-        BVHNode* node = new BVHNode{};
-
-        auto comparator = [=](BVHObjectInfo a, BVHObjectInfo b) {
-            return compare(a.aabb,b.aabb,axis);
-        };
-
-        //s'il y a un seul élément, il s'agit d'une feuille. On arrête la récursion.
-        if (idx_end - idx_start == 1){
-            node->left = node->right = nullptr;
-            node->idx = bvhs[idx_start].idx;
-            node->aabb = bvhs[idx_start].aabb;
-        }
-        // sinon, on parcourt récursivement
-        else {
-            std::sort(bvhs.begin() + idx_start, bvhs.begin() + idx_end, comparator);
-
-            int mid = idx_start + (idx_end - idx_start)/2;
-            node->left = recursive_build(bvhs, idx_start, mid, (axis+1)%3);
-            node->right = recursive_build(bvhs, mid, idx_end, (axis+1)%3);
-            node->aabb = combine(node->left->aabb,node->right->aabb);
-            node->idx = -1;
-        }
+    bool occluded(Ray ray, double t_min, double t_max);
 
-        return node;
+    // Parcours de l'arbre une seule fois pour tout le paquet (voir BVHTree::intersect_packet).
+    void intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found);
+    void occluded_packet(const RayPacket& packet, bool* occluded);
+
+    // Recopie les objets et réajuste les boîtes de l'arbre ; reconstruit l'arbre si son coût SAH
+    // dépasse rebuild_threshold fois built_cost.
+    bool update(double rebuild_threshold);
+
+protected:
+    // Construit (ou charge de cache_dir) l'arbre et le stockage des primitives sur objects.
+    // Les reconstructions de update n'utilisent pas le cache.
+    void build(ThreadPool* pool, const std::string& cache_dir = "");
+};
+
+// BVH large : l'arbre SAH binaire est effondré en noeuds à 4 enfants dont les boîtes sont testées
+// par un seul test de dalles SIMD. Les feuilles et les primitives sont celles du BVH binaire.
+class BVH4 : public BVH {
+public:
+    // Arbre large sur les mêmes feuilles que tree.
+    BVH4Tree wide;
+
+    // L'arbre large est toujours dérivé de l'arbre binaire, éventuellement chargé du cache.
+    BVH4(std::vector<Object*> objects, ThreadPool* pool = nullptr, const std::string& cache_dir = "")
+        : BVH(objects, SPLIT_SAH, pool, cache_dir) {
+        wide.build(tree);
     };
+    ~BVH4() {};
+
+    bool intersect(Ray ray, double t_min, double t_max, Intersection* hit);
+    bool occluded(Ray ray, double t_min, double t_max);
+
+    // Parcours de l'arbre large une seule fois pour tout le paquet (voir BVH4Tree::intersect_packet).
+    void intersect_packet(const RayPacket& packet, Intersection* hits, bool* hit_found);
+    void occluded_packet(const RayPacket& packet, bool* occluded);
+
+    // Met à jour l'arbre binaire (voir BVH::update), puis l'arbre large qui en découle.
+    bool update(double rebuild_threshold);
 };
 
 class Naive : virtual public IContainer {
@@ -115,4 +125,8 @@ public:
 
     //À adapter pour Naive
 	bool intersect(Ray ray, double t_min, double t_max, Intersection* hit);
+    bool occluded(Ray ray, double t_min, double t_max);
+
+    // Les objets sont testés directement, sans structure dérivée : il n'y a rien à mettre à jour.
+    bool update(double rebuild_threshold);
 };
\ No newline at end of file
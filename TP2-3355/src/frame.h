@@ -22,22 +22,25 @@ protected:
     int width, height;
 	double *color;
     double *depth;
+    double *samples;
 
 public:
 	// Construit une frame
-    Frame() : width(0), height(0), color(NULL) {}
+    Frame() : width(0), height(0), color(NULL), depth(NULL), samples(NULL) {}
 
     // Construit une frame avec les dimensions spécifiées.
     Frame(int width, int height) : width(width), height(height) 
 	{ 
-		color = new double[3 * width * height];
-		depth = new double[3 * width * height];
+		color = new double[3 * width * height]();
+		depth = new double[3 * width * height]();
+		samples = new double[3 * width * height]();
 	}
 
     // Destructor.
 	~Frame() { 
 		delete[] color;
-		delete[] depth; }
+		delete[] depth;
+		delete[] samples; }
 
 	// Sauvegarde la couleur à l'endroit spécifiée.
 	void show_color_to(std::string const &filename) const {
@@ -49,6 +52,11 @@ public:
 		show_to(filename, depth);
 	}
 
+	// Sauvegarde la carte du nombre d'échantillons par pixel (du plus petit, noir, au plus grand, blanc).
+	void show_samples_to(std::string const &filename) const {
+		show_to(filename, samples);
+	}
+
     // Modifie la couleur du pixel à la coordoonnée x,y
 	void set_color_pixel(int x, int y, double3 color) {
 		int offset = compute_offset(x,y);
@@ -67,6 +75,15 @@ public:
 		}
 	}
 
+    // Modifie le nombre d'échantillons du pixel à la coordoonnée x,y
+	void set_samples_pixel(int x, int y, double count) {
+		int offset = compute_offset(x,y);
+
+		for (int i = 0; i < 3; i++) {
+			this->samples[offset + i] = count;
+		}
+	}
+
 private:
 	
 	//Calcule le décalage dans le tableau plat.
@@ -103,6 +120,11 @@ private:
 			min_intensity = std::min(min_intensity,values[i]);
 		}
 
+		// Image uniforme : évite une division par zéro lors de la normalisation.
+		if (max_intensity <= min_intensity) {
+			max_intensity = min_intensity + 1;
+		}
+
 		FILE *f = NULL;
 		f = fopen(filename.c_str(), "wb");
 		if (!f) { puts("can't write output image to disk!"); return; }
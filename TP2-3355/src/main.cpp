@@ -13,6 +13,8 @@
 #include <map>
 #include <vector>
 #include <filesystem>
+#include <chrono>
+#include <iomanip>
 
 #include "parser.h"
 #include "raytracer.h"
@@ -47,15 +49,41 @@ int main(int argc, char **argv)
 	}
 	else
 	{	
-		Frame output = Frame{parser.scene.resolution[0], parser.scene.resolution[1]};
+		Scene& scene = parser.scene;
+		for (int iframe = 0; iframe < scene.num_frames; iframe++) {
+			// Une séquence écrit color_0000.bmp, color_0001.bmp, etc. ; une image fixe garde color.bmp.
+			std::string suffix;
+			if (scene.num_frames > 1) {
+				std::ostringstream ss;
+				ss << "_" << std::setw(4) << std::setfill('0') << iframe;
+				suffix = ss.str();
+				std::cout << "Frame " << iframe << "/" << scene.num_frames << std::endl;
+			}
 
-		// Rend la scène donnée avec le lancer de rayon
-		Raytracer raytracer;
-		raytracer.render(parser.scene, &output);
+			// La première image est celle de l'analyse ; les suivantes déplacent les objets animés
+			// puis réajustent (ou reconstruisent) l'arbre existant.
+			if (iframe > 0 && !scene.animations.empty()) {
+				auto start = std::chrono::steady_clock::now();
+				apply_animations(scene.animations, iframe);
+				bool rebuilt = scene.container->update(scene.rebuild_threshold);
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				std::cout << "Updated " << scene.animations.size() << " animated object(s): "
+				          << (rebuilt ? "rebuilt" : "refit") << " in " << ms << " ms" << std::endl;
+			}
 
-		// Sauvegarde la frame
-		output.show_color_to( (directory_scene_output / "color.bmp").string().c_str() );
-		output.show_depth_to( (directory_scene_output / "depth.bmp").string().c_str() );
+			Frame output = Frame{scene.resolution[0], scene.resolution[1]};
+
+			// Rend la scène donnée avec le lancer de rayon
+			Raytracer raytracer;
+			raytracer.render(scene, &output);
+
+			// Sauvegarde la frame
+			output.show_color_to( (directory_scene_output / ("color" + suffix + ".bmp")).string().c_str() );
+			output.show_depth_to( (directory_scene_output / ("depth" + suffix + ".bmp")).string().c_str() );
+			if (scene.adaptive_sampling) {
+				output.show_samples_to( (directory_scene_output / ("samples" + suffix + ".bmp")).string().c_str() );
+			}
+		}
 
 		std::cout << "Ray tracing finished with images saved." << std::endl;
 	}
@@ -8,6 +8,7 @@
 
 
 #include "object.h"
+#include "bvh_cache.h"
 
 // Fonction retournant soit la valeur v0 ou v1 selon le signe.
 int rsign(double value, double v0, double v1) {
@@ -35,35 +36,23 @@ double3 transform_point(double3 point, double4x4 transform) {
 // Référez-vous au PDF pour la paramétrisation des coordonnées UV.
 //
 // Pour plus de d'informations sur la géométrie, référez-vous à la classe object.h.
-bool Sphere::local_intersect(Ray ray, double t_min, double t_max, Intersection *hit) {
+bool Sphere::local_intersect(Ray ray, double t_min, double t_max, HitRecord *record) {
 	double a = dot(ray.direction, ray.direction);
 	double b = 2 * dot(ray.direction, ray.origin);
 	double c = length2(ray.origin) - pow(radius, 2);
 	double discriminant = b * b - 4 * a * c;
 
-	if (b < 0) {
-		return false;
-	}
-
 	if (discriminant > 0) { // 2 intersection points
 		// Calculate the two possible intersection depths
 		double t_0 = (-b - sqrt(discriminant)) / (2 * a);
 		double t_1 = (-b + sqrt(discriminant)) / (2 * a);
 		if (t_0 > t_min && t_0 < t_max) {
 			// If t_0 is within the valid range, set the intersection information
-			hit->depth = t_0;
-			hit->position = ray.origin + t_0 * ray.direction;
-			hit->normal = normalize(hit->position);
-			hit->uv.x = (atan2(hit->position.y, hit->position.x) + PI) / (2 * PI);
-			hit->uv.y = (hit->position.z - (-radius)) / (2 * radius);
+			record->depth = t_0;
 			return true;
 		} else if (t_1 > t_min && t_1 < t_max) {
 			// If t_1 is within the valid range, set the intersection information
-			hit->depth = t_1;
-			hit->position = ray.origin + t_1 * ray.direction;
-			hit->normal = normalize(hit->position);
-			hit->uv.x = (atan2(hit->position.y, hit->position.x) + PI) / (2 * PI);
-			hit->uv.y = (hit->position.z - (-radius)) / (2 * radius);
+			record->depth = t_1;
 			return true;
 		}
 	} else if (discriminant == 0) { // 1 intersection point
@@ -71,30 +60,47 @@ bool Sphere::local_intersect(Ray ray, double t_min, double t_max, Intersection *
 		double t = -b / (2 * a);
 		if (t > t_min && t < t_max) {
 			// If t is within the valid range, set the intersection information
-			hit->depth = t;
-			hit->position = ray.origin + t * ray.direction;
-			hit->normal = normalize(hit->position);
-			hit->uv.x = (atan2(hit->position.y, hit->position.x) + PI) / (2 * PI);
-			hit->uv.y = (hit->position.z - (-radius)) / (2 * radius);
+			record->depth = t;
 			return true;
 		}
 	}
 	return false; // No intersection found
 }
 
+// Attributs de l'intersection retenue : position, normale et coordonnées UV.
+void Sphere::local_attributes(Ray ray, const HitRecord& record, Intersection *hit) const {
+	hit->position = ray.origin + record.depth * ray.direction;
+	hit->normal = normalize(hit->position);
+	hit->uv.x = (atan2(hit->position.y, hit->position.x) + PI) / (2 * PI);
+	hit->uv.y = (hit->position.z - (-radius)) / (2 * radius);
+}
+
+// Mêmes conditions que Sphere::local_intersect, sans calculer les attributs.
+bool Sphere::local_occluded(Ray ray, double t_min, double t_max) {
+	double a = dot(ray.direction, ray.direction);
+	double b = 2 * dot(ray.direction, ray.origin);
+	double c = length2(ray.origin) - pow(radius, 2);
+	double discriminant = b * b - 4 * a * c;
+
+	if (discriminant > 0) {
+		double t_0 = (-b - sqrt(discriminant)) / (2 * a);
+		double t_1 = (-b + sqrt(discriminant)) / (2 * a);
+		return (t_0 > t_min && t_0 < t_max) || (t_1 > t_min && t_1 < t_max);
+	} else if (discriminant == 0) {
+		double t = -b / (2 * a);
+		return t > t_min && t < t_max;
+	}
+	return false;
+}
+
 AABB Sphere::compute_aabb() {
 	// Calculate the AABB in local space
 	AABB localAABB;
 	localAABB = construct_aabb({double3{-radius, -radius, -radius}, double3{radius, radius, radius}});
 	
-	// Transform the corners of the local AABB into global coordinate system
-	double3 globalMin = transform_point(localAABB.min, transform);
-	double3 globalMax = transform_point(localAABB.max, transform);
-
-	// Construct the final AABB from the transformed points
-	AABB finalAABB = construct_aabb({globalMin, globalMax});
-
-	return finalAABB;
+	// Transform the 8 corners of the local AABB into global coordinate system
+	// (only transforming min/max is wrong as soon as the object is rotated).
+	return transform_aabb(localAABB, transform);
 }
 
 // @@@@@@ VOTRE CODE ICI
@@ -103,7 +109,7 @@ AABB Sphere::compute_aabb() {
 // Référez-vous au PDF pour la paramétrisation des coordonnées UV.
 //
 // Pour plus de d'informations sur la géométrie, référez-vous à la classe object.h.
-bool Quad::local_intersect(Ray ray, double t_min, double t_max, Intersection *hit)
+bool Quad::local_intersect(Ray ray, double t_min, double t_max, HitRecord *record)
 {
 	// The normal vector of the quad
 	double3 normal = double3(0, 0, 1);
@@ -112,11 +118,13 @@ bool Quad::local_intersect(Ray ray, double t_min, double t_max, Intersection *hi
 	double denominator = dot(ray.direction, normal);
 
 	// If the ray is parallel to the quad, there's no intersection
-	if (abs(denominator) < 1e-6) {
+	// (std::abs: the unqualified abs() picked the int overload and truncated the denominator)
+	if (std::abs(denominator) < 1e-6) {
 		return false;
 	}
 
-	double t = dot(double3(0, 0, 1) - ray.origin, normal) / denominator;
+	// The quad lies in the z = 0 plane, like its bounding box
+	double t = dot(double3(0, 0, 0) - ray.origin, normal) / denominator;
 
 	// If the intersection is outside the valid range, there's no intersection
 	if (t < t_min || t > t_max) {
@@ -127,27 +135,51 @@ bool Quad::local_intersect(Ray ray, double t_min, double t_max, Intersection *hi
 	double3 intersection = ray.origin + t * ray.direction;
 
 	// If the intersection point is outside the quad, there's no intersection
-	if (intersection.x < -1 || intersection.x > 1 || intersection.y < -1 || intersection.y > 1) {
+	if (intersection.x < -half_size || intersection.x > half_size || intersection.y < -half_size || intersection.y > half_size) {
 		return false;
 	}
 
-	hit->depth = t;
+	record->depth = t;
+	return true;
+}
+
+void Quad::local_attributes(Ray ray, const HitRecord& record, Intersection *hit) const
+{
+	// The intersection point
+	double3 intersection = ray.origin + record.depth * ray.direction;
+
 	hit->position = intersection;
-	hit->normal = normal;
+	hit->normal = double3(0, 0, 1);
 
 	// Calculate UV coordinates
-	hit->uv.x = (intersection.x + 1) / 2;
-	hit->uv.y = (intersection.y + 1) / 2;
+	hit->uv.x = (intersection.x / half_size + 1) / 2;
+	hit->uv.y = (intersection.y / half_size + 1) / 2;
+}
 
-	return true;
+// Mêmes conditions que Quad::local_intersect, sans calculer les attributs.
+bool Quad::local_occluded(Ray ray, double t_min, double t_max)
+{
+	double3 normal = double3(0, 0, 1);
+	double denominator = dot(ray.direction, normal);
+	if (std::abs(denominator) < 1e-6) {
+		return false;
+	}
+
+	double t = dot(double3(0, 0, 0) - ray.origin, normal) / denominator;
+	if (t < t_min || t > t_max) {
+		return false;
+	}
+
+	double3 intersection = ray.origin + t * ray.direction;
+	return !(intersection.x < -half_size || intersection.x > half_size || intersection.y < -half_size || intersection.y > half_size);
 }
 
 AABB Quad::compute_aabb() {
 	// Compute the minimum and maximum coordinates of the quad
-	double min_x = -1;
-	double max_x = 1;
-	double min_y = -1;
-	double max_y = 1;
+	double min_x = -half_size;
+	double max_x = half_size;
+	double min_y = -half_size;
+	double max_y = half_size;
 	double min_z = 0;
 	double max_z = 0;
 
@@ -157,9 +189,9 @@ AABB Quad::compute_aabb() {
 	min_y -= EPSILON;
 	max_y += EPSILON;
 
-	// Create and return the AABB
+	// Create the local AABB and return it in the global coordinate system
 	AABB aabb = construct_aabb({double3{min_x, min_y, min_z}, double3{max_x, max_y, max_z}});
-	return aabb;
+	return transform_aabb(aabb, transform);
 }
 
 // @@@@@@ VOTRE CODE ICI
@@ -168,12 +200,13 @@ AABB Quad::compute_aabb() {
 // Référez-vous au PDF pour la paramétrisation des coordonnées UV.
 //
 // Pour plus de d'informations sur la géométrie, référez-vous à la classe object.h.
-bool Cylinder::local_intersect(Ray ray, double t_min, double t_max, Intersection *hit)
+bool Cylinder::local_intersect(Ray ray, double t_min, double t_max, HitRecord *record)
 {
 	// Calculate the coefficients of the quadratic equation for the intersection of the ray with the cylinder
+	// (open tube of axis Y, of the given radius, between -half_height and half_height)
 	double a = pow(ray.direction.x, 2) + pow(ray.direction.z, 2);
 	double b = 2 * ray.origin.x * ray.direction.x + 2 * ray.origin.z * ray.direction.z;
-	double c = pow(ray.origin.x, 2) + pow(ray.origin.z, 2) - 1;
+	double c = pow(ray.origin.x, 2) + pow(ray.origin.z, 2) - pow(radius, 2);
 	double discriminant = b * b - 4 * a * c;
 
 	// Check if the discriminant is negative, indicating no intersection with the cylinder
@@ -185,53 +218,57 @@ bool Cylinder::local_intersect(Ray ray, double t_min, double t_max, Intersection
 	double t_0 = (-b - sqrt(discriminant)) / (2 * a);
 	double t_1 = (-b + sqrt(discriminant)) / (2 * a);
 
-	// Check if either of the intersection distances is within the valid range
-	if (t_0 > t_min && t_0 < t_max) {
-		// Set the intersection information for t_0
-		hit->depth = t_0;
-		hit->position = ray.origin + t_0 * ray.direction;
-		hit->normal = double3(hit->position.x, 0, hit->position.z);
+	// Check if either of the intersection distances is within the valid range and the height of the tube
+	if (t_0 > t_min && t_0 < t_max && std::abs(ray.origin.y + t_0 * ray.direction.y) <= half_height) {
+		// Keep the intersection depth for t_0
+		record->depth = t_0;
+		return true;
+	} else if (t_1 > t_min && t_1 < t_max && std::abs(ray.origin.y + t_1 * ray.direction.y) <= half_height) {
+		// Keep the intersection depth for t_1
+		record->depth = t_1;
+		return true;
+	}
 
-		// Calculate UV coordinates
-		double u = atan2(hit->position.x, hit->position.z) / (2 * PI);
-		double v = hit->position.y;
+	return false; // No intersection found
+}
 
-		// Update UV coordinates
-		hit->uv = double2(u, v);
+void Cylinder::local_attributes(Ray ray, const HitRecord& record, Intersection *hit) const
+{
+	hit->position = ray.origin + record.depth * ray.direction;
+	hit->normal = double3(hit->position.x, 0, hit->position.z);
 
-		return true;
-	} else if (t_1 > t_min && t_1 < t_max) {
-		// Set the intersection information for t_1
-		hit->depth = t_1;
-		hit->position = ray.origin + t_1 * ray.direction;
-		hit->normal = double3(hit->position.x, 0, hit->position.z);
+	// Calculate UV coordinates (both in [0, 1])
+	double u = (atan2(hit->position.x, hit->position.z) + PI) / (2 * PI);
+	double v = (hit->position.y + half_height) / (2 * half_height);
 
-		// Calculate UV coordinates
-		double u = atan2(hit->position.x, hit->position.z) / (2 * PI);
-		double v = hit->position.y;
+	// Update UV coordinates
+	hit->uv = double2(u, v);
+}
 
-		// Update UV coordinates
-		hit->uv = double2(u, v);
+// Mêmes conditions que Cylinder::local_intersect, sans calculer les attributs.
+bool Cylinder::local_occluded(Ray ray, double t_min, double t_max)
+{
+	double a = pow(ray.direction.x, 2) + pow(ray.direction.z, 2);
+	double b = 2 * ray.origin.x * ray.direction.x + 2 * ray.origin.z * ray.direction.z;
+	double c = pow(ray.origin.x, 2) + pow(ray.origin.z, 2) - pow(radius, 2);
+	double discriminant = b * b - 4 * a * c;
 
-		return true;
+	if (discriminant < 0) {
+		return false;
 	}
 
-	return false; // No intersection found
+	double t_0 = (-b - sqrt(discriminant)) / (2 * a);
+	double t_1 = (-b + sqrt(discriminant)) / (2 * a);
+	return (t_0 > t_min && t_0 < t_max && std::abs(ray.origin.y + t_0 * ray.direction.y) <= half_height)
+	    || (t_1 > t_min && t_1 < t_max && std::abs(ray.origin.y + t_1 * ray.direction.y) <= half_height);
 }
 
-
 AABB Cylinder::compute_aabb() {
 	// Calculate AABB in local space
-	AABB localAABB = construct_aabb({double3{-1, -1, -1}, double3{1, 1, 1}});
-
-	// Reproject corners into global coordinate system
-	double3 transformedMin = transform_point(localAABB.min, transform);
-	double3 transformedMax = transform_point(localAABB.max, transform);
+	AABB localAABB = construct_aabb({double3{-radius, -half_height, -radius}, double3{radius, half_height, radius}});
 
-	// Construct final AABB from transformed points
-	AABB globalAABB = construct_aabb({transformedMin, transformedMax});
-
-	return globalAABB;
+	// Reproject the 8 corners into global coordinate system
+	return transform_aabb(localAABB, transform);
 }
 
 // @@@@@@ VOTRE CODE ICI
@@ -243,62 +280,113 @@ AABB Cylinder::compute_aabb() {
 //
 bool Mesh::local_intersect(Ray ray,  
 						   double t_min, double t_max, 
-						   Intersection* hit)
+						   HitRecord* record)
 {
-	double closest_hit_distance = std::numeric_limits<double>::max();
-	bool hit_found = false;
-
-	// Parcourir tous les triangles
-	for (auto& tri : triangles) {
-		Intersection temp_hit;
-		if (intersect_triangle(ray, t_min, closest_hit_distance, tri, &temp_hit)) {
-			hit_found = true;
-			closest_hit_distance = temp_hit.depth;
-			*hit = temp_hit;
-		}
+	// Parcourir les triangles à l'aide du BVH local, en rétrécissant l'intervalle à chaque intersection.
+#if RAY_HAS_AVX2_KERNELS
+	if (Simd::active() == SIMD_AVX2 && !data->packs.empty()) {
+		// The 8-wide kernel discards the triangles that cannot be hit; the remaining candidates go
+		// through the exact test, in the same order, so the result is identical to the scalar path.
+		return data->blas.intersect(ray, t_min, t_max, [&](int first, int count, double* closest) {
+			bool hit_found = false;
+			uint32_t mask = intersect_pack8_avx2(data->packs[data->leaf_pack[first]], ray, t_min, *closest);
+			STAT_ADD(STAT_TRIANGLE_PACKS_TESTED, 1);
+			for (int lane = 0; lane < count; lane++) {
+				if (!(mask & (1u << lane))) {
+					continue;
+				}
+				STAT_ADD(STAT_TRIANGLE_PACK_CANDIDATES, 1);
+				if (intersect_triangle(ray, t_min, *closest, first + lane, record)) {
+					hit_found = true;
+					*closest = record->depth;
+				}
+			}
+			return hit_found;
+		});
 	}
-	return hit_found;
+#endif
+
+	return data->blas.intersect(ray, t_min, t_max, [&](int first, int count, double* closest) {
+		bool hit_found = false;
+		for (int itri = first; itri < first + count; itri++) {
+			if (intersect_triangle(ray, t_min, *closest, itri, record)) {
+				hit_found = true;
+				*closest = record->depth;
+			}
+		}
+		return hit_found;
+	});
 }
 
 // @@@@@@ VOTRE CODE ICI
 // Occupez-vous de compléter cette fonction afin de trouver l'intersection avec un triangle.
-// S'il y a intersection, remplissez hit avec l'information sur la normale et les coordonnées texture.
+// S'il y a intersection, remplissez record avec la profondeur et les coordonnées barycentriques ;
+// la normale est calculée par local_attributes pour l'intersection retenue seulement.
 bool Mesh::intersect_triangle(Ray  ray, 
 							  double t_min, double t_max,
-							  Triangle const tri,
-							  Intersection *hit)
+							  int itri,
+							  HitRecord *record)
 {
-	// Extrait chaque position de sommet des données du maillage.
-	double3 const &p0 = positions[tri[0].pi]; // ou Sommet A (Pour faciliter les explications)
-	double3 const &p1 = positions[tri[1].pi]; // ou Sommet B
-	double3 const &p2 = positions[tri[2].pi]; // ou Sommet C
-
 	// Triangle en question. Respectez la convention suivante pour vos variables.
 	//
 	//     A
 	//    / \
-	//   /   \
+	//   /   \
 	//  B --> C
 	//
 	// Respectez la règle de la main droite pour la normale.
 
 	// @@@@@@ VOTRE CODE ICI
 	// Décidez si le rayon intersecte le triangle (p0,p1,p2).
-	// Si c'est le cas, remplissez la structure hit avec les informations
+	// Si c'est le cas, remplissez la structure record avec les informations
 	// de l'intersection et renvoyez true.
 	// Pour plus de d'informations sur la géométrie, référez-vous à la classe dans object.hpp.
 	//
-	// NOTE : hit.depth est la profondeur de l'intersection actuellement la plus proche,
+	// NOTE : t_max est la profondeur de l'intersection actuellement la plus proche,
 	// donc n'acceptez pas les intersections qui occurent plus loin que cette valeur.
 
-	
+	double t, u, v;
+	if (!data->hit_triangle(ray, t_min, t_max, data->triangles[itri], &t, &u, &v)) {
+		return false;
+	}
+
+	// Fill the hit record with intersection information
+	record->depth = t;
+	record->primitive = itri;
+	record->local = double2{u, v};
+
+	return true; // Intersection found
+}
+
+void Mesh::local_attributes(Ray ray, const HitRecord& record, Intersection *hit) const
+{
+	// Extrait chaque position de sommet des données du maillage.
+	const Triangle& tri = data->triangles[record.primitive];
+	double3 const &p0 = data->positions[tri[0].pi]; // ou Sommet A (Pour faciliter les explications)
+	double3 const &p1 = data->positions[tri[1].pi]; // ou Sommet B
+	double3 const &p2 = data->positions[tri[2].pi]; // ou Sommet C
+
+	hit->position = ray.origin + record.depth * ray.direction;
+	hit->normal = normalize(cross(p1 - p0, p2 - p0));
+	hit->uv = double2{0, 0};
+}
+
+bool MeshData::hit_triangle(Ray const& ray,
+							double t_min, double t_max,
+							Triangle const& tri,
+							double* out_t, double* out_u, double* out_v) const
+{
+	double3 const &p0 = positions[tri[0].pi];
+	double3 const &p1 = positions[tri[1].pi];
+	double3 const &p2 = positions[tri[2].pi];
+
 	// Intersection test between the ray and the triangle (p0, p1, p2)
 	double3 edge1 = p1 - p0;
 	double3 edge2 = p2 - p0;
 	double3 h = cross(ray.direction, edge2);
 	double determinant = dot(edge1, h);
 
-	if (abs(determinant) < EPSILON) {
+	if (std::abs(determinant) < EPSILON) {
 		return false; // Ray is parallel to the triangle
 	}
 
@@ -323,25 +411,164 @@ bool Mesh::intersect_triangle(Ray  ray,
 		return false; // Intersection is outside the valid t range
 	}
 
-	// Fill the hit structure with intersection information
-	hit->depth = t;
-	hit->position = ray.origin + t * ray.direction;
-	hit->normal = normalize(cross(edge1, edge2));
+	*out_t = t;
+	*out_u = u;
+	*out_v = v;
+	return true;
+}
 
-	return true; // Intersection found
+bool Mesh::local_occluded(Ray ray, double t_min, double t_max)
+{
+#if RAY_HAS_AVX2_KERNELS
+	if (Simd::active() == SIMD_AVX2 && !data->packs.empty()) {
+		return data->blas.occluded(ray, t_min, t_max, [&](int first, int count) {
+			double t, u, v;
+			uint32_t mask = intersect_pack8_avx2(data->packs[data->leaf_pack[first]], ray, t_min, t_max);
+			STAT_ADD(STAT_TRIANGLE_PACKS_TESTED, 1);
+			for (int lane = 0; lane < count; lane++) {
+				if (mask & (1u << lane)) {
+					STAT_ADD(STAT_TRIANGLE_PACK_CANDIDATES, 1);
+					if (data->hit_triangle(ray, t_min, t_max, data->triangles[first + lane], &t, &u, &v)) {
+						return true;
+					}
+				}
+			}
+			return false;
+		});
+	}
+#endif
+
+	return data->blas.occluded(ray, t_min, t_max, [&](int first, int count) {
+		double t, u, v;
+		for (int itri = first; itri < first + count; itri++) {
+			if (data->hit_triangle(ray, t_min, t_max, data->triangles[itri], &t, &u, &v)) {
+				return true;
+			}
+		}
+		return false;
+	});
+}
+
+void MeshData::build_blas(ThreadPool* pool)
+{
+	std::vector<BVHObjectInfo> infos;
+	for (int itri = 0; itri < static_cast<int>(triangles.size()); itri++) {
+		const Triangle& tri = triangles[itri];
+		infos.push_back({itri, construct_aabb({positions[tri[0].pi], positions[tri[1].pi], positions[tri[2].pi]})});
+	}
+
+	// With AVX2 available, a leaf is tested as one pack of up to 8 triangles; the tree is built
+	// for the hardware rather than the selected level, which is only applied when rendering.
+	// Spatial splits clip the triangle itself rather than its box, so the pieces stay tight.
+	auto clip = [&](int itri, const AABB& box, int axis, double lo, double hi) {
+		const Triangle& tri = triangles[itri];
+		AABB part = clip_triangle(positions[tri[0].pi], positions[tri[1].pi], positions[tri[2].pi], axis, lo, hi);
+		return intersect_aabb(part, box);
+	};
+
+	// The triangle boxes key the cache; the clipped pieces also depend on the exact vertices.
+	uint64_t geometry_hash = BVH_CACHE_HASH_SEED;
+	if (!cache_dir.empty()) {
+		geometry_hash = hash_bytes(geometry_hash, positions.data(), positions.size() * sizeof(double3));
+		for (const Triangle& tri : triangles) {
+			int32_t pi[3] = {tri[0].pi, tri[1].pi, tri[2].pi};
+			geometry_hash = hash_bytes(geometry_hash, pi, sizeof(pi));
+		}
+	}
+	build_bvh_cached(blas, infos, blas_method, Simd::avx2_supported() ? TRIANGLE_PACK_WIDTH : 1, pool, cache_dir,
+	                 geometry_hash, clip);
+
+	std::vector<Triangle> ordered;
+	ordered.reserve(triangles.size());
+	for (auto& info : infos) {
+		ordered.push_back(triangles[info.idx]);
+	}
+	triangles = ordered;
+}
+
+void MeshData::build_packs()
+{
+	packs.clear();
+	leaf_pack.assign(triangles.size(), -1);
+	if (!Simd::avx2_supported()) {
+		return;
+	}
+
+	for (const LinearBVHNode& node : blas.nodes) {
+		if (node.n_primitives == 0) {
+			continue;
+		}
+
+		// Each leaf holds at most TRIANGLE_PACK_WIDTH triangles: one pack per leaf.
+		// The pack is anchored on the first vertex of the leaf to keep the float offsets small.
+		TrianglePack8 pack = {};
+		pack.origin = positions[triangles[node.primitives_offset][0].pi];
+		for (int lane = 0; lane < node.n_primitives; lane++) {
+			const Triangle& tri = triangles[node.primitives_offset + lane];
+			double3 p0 = positions[tri[0].pi];
+			double3 edge1 = positions[tri[1].pi] - p0;
+			double3 edge2 = positions[tri[2].pi] - p0;
+			for (int k = 0; k < 3; k++) {
+				pack.p0[k][lane] = static_cast<float>(p0[k] - pack.origin[k]);
+				pack.edge1[k][lane] = static_cast<float>(edge1[k]);
+				pack.edge2[k][lane] = static_cast<float>(edge2[k]);
+			}
+		}
+
+		leaf_pack[node.primitives_offset] = static_cast<int32_t>(packs.size());
+		packs.push_back(pack);
+	}
 }
 
 // @@@@@@ VOTRE CODE ICI
 // Occupez-vous de compléter cette fonction afin de calculer le AABB pour le Mesh.
 // Il faut que le AABB englobe minimalement notre objet à moins que l'énoncé prononce le contraire.
 AABB Mesh::compute_aabb() {
-	double3 min = double3(std::numeric_limits<double>::max());
-	double3 max = double3(std::numeric_limits<double>::min());
+	// The local-space bounds are computed once per OBJ file and shared by every instance;
+	// reproject their 8 corners into the global coordinate system
+	return transform_aabb(data->bounds, transform);
+}
+// Même transformation vers le repère local que Object::intersect, mais l'appel à local_intersect
+// est qualifié par le type exact : aucun appel virtuel par candidat.
+template <class T>
+bool PrimitiveKernels::intersect(T* prims, int count, const Ray& ray, double t_min, double* closest, HitRecord* record)
+{
+	bool hit_found = false;
+	for (int i = 0; i < count; i++) {
+		STAT_ADD(STAT_PRIMITIVES_TESTED, 1);
+		T& prim = prims[i];
+		Ray lray{mul(prim.i_transform, {ray.origin,1}).xyz(), mul(prim.i_transform, {ray.direction,0}).xyz()};
+
+		HitRecord temp_record;
+		if (prim.T::local_intersect(lray, t_min, *closest, &temp_record)) {
+			temp_record.object = &prim;
+			*record = temp_record;
+			*closest = temp_record.depth;
+			hit_found = true;
+		}
+	}
+	return hit_found;
+}
 
-	// Find the minimum and maximum coordinates of the mesh
-	for (auto& pos : positions) {
-		min = linalg::min(min, pos);
-		max = linalg::max(max, pos);
+template <class T>
+bool PrimitiveKernels::occluded(T* prims, int count, const Ray& ray, double t_min, double t_max)
+{
+	for (int i = 0; i < count; i++) {
+		STAT_ADD(STAT_PRIMITIVES_TESTED, 1);
+		T& prim = prims[i];
+		Ray lray{mul(prim.i_transform, {ray.origin,1}).xyz(), mul(prim.i_transform, {ray.direction,0}).xyz()};
+		if (prim.T::local_occluded(lray, t_min, t_max)) {
+			return true;
+		}
 	}
-	return construct_aabb({min, max});
-}
\ No newline at end of file
+	return false;
+}
+
+#define INSTANTIATE_PRIMITIVE_KERNELS(_type) \
+	template bool PrimitiveKernels::intersect<_type>(_type*, int, const Ray&, double, double*, HitRecord*); \
+	template bool PrimitiveKernels::occluded<_type>(_type*, int, const Ray&, double, double);
+
+INSTANTIATE_PRIMITIVE_KERNELS(Sphere)
+INSTANTIATE_PRIMITIVE_KERNELS(Quad)
+INSTANTIATE_PRIMITIVE_KERNELS(Cylinder)
+INSTANTIATE_PRIMITIVE_KERNELS(Mesh)
@@ -3,10 +3,12 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <cmath>
 #include <cfloat>
+#include <cstdint>
 #include <string>
 
 #include "basic.h"
@@ -14,6 +16,8 @@
 #include "linalg/linalg.h"
 using namespace linalg::aliases;
 #include "aabb.h"
+#include "bvh.h"
+#include "simd.h"
 
 // Le type d'une "liste de paramètres", e.g. une map de strings vers des listes de nombres.
 typedef std::map<std::string, std::vector<double> > ParamList;
@@ -73,6 +77,9 @@ public:
     double k_refraction;
 };
 
+// Indice d'un matériau dans la table dense ResourceManager::materials, résolu à l'analyse de la scène.
+typedef uint32_t MaterialHandle;
+
 // Une classe pour encapsuler l'information suite à l'intersection.
 class Intersection {
 public:
@@ -88,10 +95,39 @@ public:
 	// Les coordonnées UV associées à l'intersection [entre 0 et 1]
 	double2 uv;
 
-    // La clé associée au matériel utilisé.
-    std::string key_material;
+    // Le matériau de l'objet touché.
+    MaterialHandle material;
+
+	Intersection() : depth(DBL_MAX), material(0) {}
+};
+
+class Object;
+
+// Types concrets d'objets. Sert d'étiquette pour regrouper les primitives par type
+// (voir PrimitiveStore) et les intersecter sans appel virtuel.
+enum PrimitiveType {
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_QUAD,
+    PRIMITIVE_CYLINDER,
+    PRIMITIVE_MESH,
+
+    PRIMITIVE_TYPE_COUNT
+};
+
+// Intersection minimale (POD) conservée pendant la traversée. Les attributs de surface ne sont
+// calculés qu'une fois la plus proche intersection connue (voir Object::resolve).
+struct HitRecord {
+    // La profondeur du rayon
+    double depth = DBL_MAX;
+
+    // L'objet touché.
+    const Object* object = nullptr;
 
-	Intersection() : depth(DBL_MAX) {}
+    // La primitive touchée dans l'objet (triangle d'un maillage, 0 sinon).
+    int primitive = 0;
+
+    // Coordonnées locales à la primitive (barycentriques (u,v) d'un triangle).
+    double2 local{0, 0};
 };
 
 // Classe abstraite de base pour les objets.
@@ -103,7 +139,7 @@ public:
     
     double3x3 n_transform; // Transformation de l'espace de l'objet à l'espace global pour les normales (local --> global).
 
-    std::string key_material; // Matériau de l'objet.
+    MaterialHandle material; // Matériau de l'objet.
 
     // Mets en place les 3 transformations à partir de la transformation (global-vers-objet) donnée.
     void setup_transform(double4x4 m)
@@ -116,10 +152,11 @@ public:
     };
 
     // Intersecte l'objet avec le rayon donné dans le repère global.
-    // Retourne true s'il y a eu une intersection avec de l'information sur l'intersection.
+    // Retourne true s'il y a eu une intersection ; seul l'enregistrement minimal (profondeur,
+    // objet, primitive) est rempli, les attributs sont évalués plus tard par resolve().
     bool intersect(Ray ray, 
                    double t_min, double t_max, 
-                   Intersection* hit) {
+                   HitRecord* record) {
 
         //Rayon dans le repère locale
         Ray lray{mul(i_transform, {ray.origin,1}).xyz(), mul(i_transform, {ray.direction,0}).xyz()};
@@ -128,23 +165,50 @@ public:
         //                 ray.origin + ray.direction * t, alors t est la PROFONDEUR
         
         //!!! NOTE UTILE : Assurez-vous que la profondeur du rayon soit contenu entre t_min et t_max.
-        if (local_intersect(lray, t_min, t_max, hit)) 
+        if (local_intersect(lray, t_min, t_max, record)) 
         {
-            //!!! NOTE UTILE : Assurez-vous que la normale est bien normalisée
-            //                 et que les coordonnées UV sont contenus [0..1]
-
-            hit->key_material = key_material;
-
-            // Transforme les coordonnées de l'intersection dans le repère GLOBAL.
-            hit->position = mul(transform,{hit->position,1}).xyz();
-            hit->normal = normalize(mul(n_transform, hit->normal));
-            
+            record->object = this;
             return true;
         }
 
         return false;
     };
 
+    // Calcule les attributs complets (position, normale, uv, matériau) d'une intersection trouvée
+    // par intersect() avec le même rayon. Appelée une seule fois, pour l'intersection la plus proche.
+    void resolve(Ray ray, const HitRecord& record, Intersection* hit) const {
+        Ray lray{mul(i_transform, {ray.origin,1}).xyz(), mul(i_transform, {ray.direction,0}).xyz()};
+        local_attributes(lray, record, hit);
+
+        //!!! NOTE UTILE : Assurez-vous que la normale est bien normalisée
+        //                 et que les coordonnées UV sont contenus [0..1]
+
+        hit->depth = record.depth;
+        hit->material = material;
+
+        // Transforme les coordonnées de l'intersection dans le repère GLOBAL.
+        hit->position = mul(transform,{hit->position,1}).xyz();
+        hit->normal = normalize(mul(n_transform, hit->normal));
+    };
+
+    // intersect() suivi de resolve().
+    bool intersect(Ray ray, double t_min, double t_max, Intersection* hit) {
+        HitRecord record;
+        if (!intersect(ray, t_min, t_max, &record)) {
+            return false;
+        }
+        resolve(ray, record, hit);
+        return true;
+    };
+
+    // Détermine si le rayon (repère global) touche l'objet dans l'intervalle donné.
+    // Contrairement à intersect(), aucune information d'intersection (normale, uv, matériau)
+    // n'est calculée : utilisé par les rayons d'ombre.
+    bool occluded(Ray ray, double t_min, double t_max) {
+        Ray lray{mul(i_transform, {ray.origin,1}).xyz(), mul(i_transform, {ray.direction,0}).xyz()};
+        return local_occluded(lray, t_min, t_max);
+    };
+
     // Construit la boite englobante pour l'objet donnée.
     //
     // !!!NOTE UTILE : Ceci doit être appelé après que les objets soient formées et avant 
@@ -157,17 +221,32 @@ public:
 
         return aabb;
     };
+
+    // Type concret de l'objet.
+    virtual PrimitiveType primitive_type() const = 0;
     
 protected:
     // Intersecte l'objet avec le rayon donné dans le repère local.
     // Cette fonction est spécifique à chaque sous-type d'objet.
-    // Retourne true s'il y a eu une intersection, hit est alors mis à jour avec les paramètres.
-    virtual bool local_intersect(Ray ray, double t_min, double t_max, Intersection* hit) = 0;
+    // Retourne true s'il y a eu une intersection ; record reçoit alors la profondeur
+    // (et, au besoin, la primitive et ses coordonnées locales).
+    virtual bool local_intersect(Ray ray, double t_min, double t_max, HitRecord* record) = 0;
+
+    // Remplit la position, la normale et les coordonnées uv (repère local) d'une intersection
+    // trouvée par local_intersect avec le même rayon local.
+    virtual void local_attributes(Ray ray, const HitRecord& record, Intersection* hit) const = 0;
+
+    // Détermine s'il existe une intersection dans le repère local, sans calculer ses attributs.
+    // Par défaut, on se rabat sur local_intersect() ; les sous-types fournissent une version plus rapide.
+    virtual bool local_occluded(Ray ray, double t_min, double t_max) {
+        HitRecord record;
+        return local_intersect(ray, t_min, t_max, &record);
+    };
 };
 
 
 // Espace Local: Sphère centrée à l'origine avec un rayon (radius).
-class Sphere : public Object
+class Sphere final : public Object
 {
 public:
     //Rayon de la sphère
@@ -177,15 +256,20 @@ public:
 
     //À adapter pour la sphère.
     virtual AABB compute_aabb();
+    virtual PrimitiveType primitive_type() const { return PRIMITIVE_SPHERE; }
 protected:
+    friend struct PrimitiveKernels;
+
     //À adapter pour la sphère
-    virtual bool local_intersect(Ray ray, double t_min, double t_max, Intersection* hit);
+    virtual bool local_intersect(Ray ray, double t_min, double t_max, HitRecord* record);
+    virtual void local_attributes(Ray ray, const HitRecord& record, Intersection* hit) const;
+    virtual bool local_occluded(Ray ray, double t_min, double t_max);
 };
 
 
 // Espace Local: Quad(Rectangle) centrée à l'origine tel que la normale
 //               est Z+ pour une largeur de (2 * half_size) x (2 * half_size)
-class Quad : public Object
+class Quad final : public Object
 {
 public:
     //Demi-Largeur
@@ -195,14 +279,19 @@ public:
 
     //À adapter pour le plan
     virtual AABB compute_aabb();
+    virtual PrimitiveType primitive_type() const { return PRIMITIVE_QUAD; }
 protected:
+    friend struct PrimitiveKernels;
+
     //À adapter pour le plan
-    virtual bool local_intersect(Ray const ray, double t_min, double t_max, Intersection* hit);
+    virtual bool local_intersect(Ray const ray, double t_min, double t_max, HitRecord* record);
+    virtual void local_attributes(Ray ray, const HitRecord& record, Intersection* hit) const;
+    virtual bool local_occluded(Ray ray, double t_min, double t_max);
 };
 
 // Espace Local: Cylindre tel que l'axe principale est aligné à l'axe Y
 //               pour une hauteur (2 * half_height) avec un rayon (radius).
-class Cylinder : public Object
+class Cylinder final : public Object
 {
 public:
     //Rayon du cylindre
@@ -214,9 +303,14 @@ public:
 
     //À adapter pour le cylindre
     virtual AABB compute_aabb();
+    virtual PrimitiveType primitive_type() const { return PRIMITIVE_CYLINDER; }
 protected:
+    friend struct PrimitiveKernels;
+
     //À adapter pour le cylindre
-    virtual bool local_intersect(Ray ray, double t_min, double t_max, Intersection* hit);
+    virtual bool local_intersect(Ray ray, double t_min, double t_max, HitRecord* record);
+    virtual void local_attributes(Ray ray, const HitRecord& record, Intersection* hit) const;
+    virtual bool local_occluded(Ray ray, double t_min, double t_max);
 };
 
 // Une classe pour représenter le sommet d'un polygone. 
@@ -253,9 +347,10 @@ public:
     const Vertex& operator[](int i) const { return v[i]; }
 };
 
-// Espace Local: Mesh centrée à l'origine avec les positions spécifiées, normales et les coordonnées de textures
-//               associés à chaque triangle.
-class Mesh : public Object {
+// Géométrie d'un fichier OBJ : sommets, triangles et BVH local, dans le repère de l'objet.
+// Chargée une seule fois par fichier (voir ResourceManager::load_mesh) puis partagée, en lecture seule,
+// par toutes les instances Mesh qui la placent dans la scène.
+class MeshData {
 public:
     // Contenant pour les positions, coordonnées de texture, normales et couleurs. Recherche par indice.
     std::vector<double3> positions;
@@ -263,10 +358,35 @@ public:
     std::vector<double2> tex_coords;
 
     // Les triangles sont des triplets de sommets.
+    // NOTE: Réordonnés lors de la construction du BVH local afin que les triangles d'une feuille soient contigus.
     std::vector<Triangle> triangles;
 
-    // Lis les données OBJ d'un fichier donné.
-    Mesh(std::ifstream& file)
+    // BVH local (niveau inférieur) sur les triangles, dans le repère de l'objet.
+    // Si le processeur supporte AVX2, ses feuilles contiennent jusqu'à TRIANGLE_PACK_WIDTH triangles,
+    // soit un paquet SIMD.
+    BVHTree blas;
+
+    // Triangles de chaque feuille du BVH local, regroupés en paquets SoA pour le noyau AVX2
+    // (vide sans support AVX2).
+    std::vector<TrianglePack8> packs;
+
+    // Indice du paquet d'une feuille, indexé par le premier triangle de la feuille (-1 sinon).
+    std::vector<int32_t> leaf_pack;
+
+    // Boîte englobante des positions, dans le repère de l'objet.
+    AABB bounds;
+
+    // Méthode de construction du BVH local : SPLIT_SAH, ou SPLIT_SBVH pour découper les longs
+    // triangles entre les feuilles.
+    BVHSplitMethod blas_method;
+
+    // Dossier du cache disque du BVH local (voir build_bvh_cached) ; vide pour le désactiver.
+    std::string cache_dir;
+
+    // Lis les données OBJ d'un fichier donné. Le BVH local n'est pas encore construit (voir build) :
+    // il l'est une fois la scène lue, avec les fils du rendu.
+    MeshData(std::ifstream& file, BVHSplitMethod blas_method = SPLIT_SAH, const std::string& cache_dir = "")
+        : blas_method(blas_method), cache_dir(cache_dir)
     {
 
         // Continue de récupérer les codes opérationnel et de les analyser. Nous supposons
@@ -375,19 +495,77 @@ public:
                 std::cerr << "unknown opCode '" << opCode << "'" << std::endl;
             }
         }
+
+        bounds = construct_aabb(positions);
     }
 
+    // Construit le BVH local puis les paquets SIMD ; pool est partagé par les constructions de la scène.
+    void build(ThreadPool* pool)
+    {
+        build_blas(pool);
+        build_packs();
+    }
+
+    // Vrai tant que build n'a pas été appelée (et que le maillage a des triangles).
+    bool needs_build() const { return blas.empty() && !triangles.empty(); }
+
+    // Construit le BVH local sur les triangles et réordonne les triangles en conséquence.
+    // Avec SPLIT_SBVH, un triangle peut être référencé par plusieurs feuilles : il est alors dupliqué.
+    // L'arbre est chargé de cache_dir s'il y a été écrit pour les mêmes sommets et triangles.
+    void build_blas(ThreadPool* pool);
+
+    // Remplit packs et leaf_pack à partir des feuilles du BVH local.
+    void build_packs();
+
+    // Test de Möller-Trumbore seul : renvoie true ssi le rayon touche le triangle dans [t_min, t_max],
+    // avec la profondeur et les coordonnées barycentriques (u,v) dans t, u et v.
+    bool hit_triangle(Ray const& ray,
+                      double t_min, double t_max,
+                      Triangle const& tri,
+                      double* t, double* u, double* v) const;
+};
+
+// Espace Local: Mesh centrée à l'origine avec les positions spécifiées, normales et les coordonnées de textures
+//               associés à chaque triangle.
+// Une instance ne porte que sa transformation et son matériau ; la géométrie est partagée.
+class Mesh final : public Object {
+public:
+    // Géométrie partagée entre toutes les instances du même fichier OBJ.
+    std::shared_ptr<const MeshData> data;
+
+    Mesh(std::shared_ptr<const MeshData> data) : data(std::move(data)) {}
+
     //À adapter pour le mesh
     virtual AABB compute_aabb();
+    virtual PrimitiveType primitive_type() const { return PRIMITIVE_MESH; }
 protected:
-    //À adapter pour le mesh
-    virtual bool local_intersect(Ray const ray, double t_min, double t_max, Intersection* hit);
+    friend struct PrimitiveKernels;
 
-    // Trouve le point d'intersection entre le rayon donné et le maillage triangulaire.
-    // Renvoie true ssi une intersection existe, et remplit les données de
-    // la structure hit avec les bonnes informations.
+    //À adapter pour le mesh
+    virtual bool local_intersect(Ray const ray, double t_min, double t_max, HitRecord* record);
+    // Normale du triangle retenu ; la position est recalculée à partir de la profondeur.
+    virtual void local_attributes(Ray ray, const HitRecord& record, Intersection* hit) const;
+    // S'arrête au premier triangle touché.
+    virtual bool local_occluded(Ray ray, double t_min, double t_max);
+
+    // Trouve le point d'intersection entre le rayon donné et le triangle itri du maillage.
+    // Renvoie true ssi une intersection existe, et remplit record avec la profondeur,
+    // le triangle et les coordonnées barycentriques.
     bool intersect_triangle(Ray const ray,
                             double t_min, double t_max,
-                            Triangle const tri,
-                            Intersection *hit);
+                            int itri,
+                            HitRecord *record);
+};
+
+// Noyaux de feuille sans appel virtuel : T est le type exact des count primitives contiguës de prims,
+// donc local_intersect et local_occluded sont résolus statiquement et peuvent être mis en ligne.
+// Instanciés dans object.cpp pour Sphere, Quad, Cylinder et Mesh.
+struct PrimitiveKernels {
+    // Intersection la plus proche dans [t_min, *closest] ; met à jour closest et record.
+    template <class T>
+    static bool intersect(T* prims, int count, const Ray& ray, double t_min, double* closest, HitRecord* record);
+
+    // Vrai dès qu'une des primitives bloque le rayon dans [t_min, t_max].
+    template <class T>
+    static bool occluded(T* prims, int count, const Ray& ray, double t_min, double t_max);
 };
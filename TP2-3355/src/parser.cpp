@@ -257,7 +257,7 @@ ParamList Lexer::get_param_list(unsigned int min, unsigned int max) {
 
 bool Parser::parse() {
 
-    transform_stack.push_back(linalg::identity);
+    transform_stack.push_back(TransformState{linalg::identity, {}, false});
 
     std::string container;
 
@@ -265,14 +265,43 @@ bool Parser::parse() {
 
         Token token = lexer.peek();
         switch (token.type) {
-            case END_OF_FILE:
+            case END_OF_FILE: {
+                // Les arbres sont construits avec les fils du rendu, tous sur le même pool, ou chargés
+                // du cache disque. Les BVH locaux des maillages d'abord, leurs boîtes n'en dépendent pas.
+                ThreadPool build_pool(scene.num_threads);
+                for (auto& entry : ResourceManager::Instance()->meshes) {
+                    MeshData& data = *entry.second;
+                    if (data.needs_build()) {
+                        data.build(&build_pool);
+                        std::cout << "Mesh BVH build (" << entry.first << "): ";
+                        data.blas.report.print(std::cout);
+                    }
+                }
+
+                const std::string& cache_dir = ResourceManager::Instance()->bvh_cache_dir;
+                BVH* bvh = nullptr;
                 if (container == "BVH") {
-                    scene.container = new BVH(objects);
+                    bvh = new BVH(objects, SPLIT_MEDIAN, &build_pool, cache_dir);
+                } else if (container == "SAH") {
+                    bvh = new BVH(objects, SPLIT_SAH, &build_pool, cache_dir);
+                } else if (container == "LBVH") {
+                    bvh = new BVH(objects, SPLIT_LBVH, &build_pool, cache_dir);
+                } else if (container == "SBVH") {
+                    bvh = new BVH(objects, SPLIT_SBVH, &build_pool, cache_dir);
+                } else if (container == "BVH4") {
+                    bvh = new BVH4(objects, &build_pool, cache_dir);
                 } else if (container == "Naive") {
                     scene.container = new Naive(objects);
                 }
 
+                if (bvh) {
+                    scene.container = bvh;
+                    std::cout << container << " build: ";
+                    bvh->tree.report.print(std::cout);
+                }
+
                 return true;
+            }
             case ERROR:
                 std::cerr << "parsing failed due to lexing error" << std::endl;
                 return false;
@@ -294,7 +323,21 @@ bool Parser::parse() {
             HANDLE_NAME(jitter_radius)
             HANDLE_NAME(samples_per_pixel)
             HANDLE_NAME(ambient_light)
+            HANDLE_NAME(shadow_samples)
+            HANDLE_NAME(adaptive_shadows)
             HANDLE_NAME(max_ray_depth)
+            HANDLE_NAME(min_throughput)
+            HANDLE_NAME(russian_roulette)
+            HANDLE_NAME(num_threads)
+            HANDLE_NAME(seed)
+            HANDLE_NAME(simd)
+            HANDLE_NAME(ray_packets)
+            HANDLE_NAME(integrator)
+            HANDLE_NAME(adaptive_sampling)
+            HANDLE_NAME(frames)
+            HANDLE_NAME(rebuild_threshold)
+            HANDLE_NAME(mesh_bvh)
+            HANDLE_NAME(bvh_cache)
             HANDLE_NAME(jitter_radius)
 
 
@@ -308,6 +351,9 @@ bool Parser::parse() {
             HANDLE_NAME(Translate)
             HANDLE_NAME(Scale)
             HANDLE_NAME(Rotate)
+            HANDLE_NAME(AnimatedTranslate)
+            HANDLE_NAME(AnimatedScale)
+            HANDLE_NAME(AnimatedRotate)
 
             HANDLE_NAME(Sphere)
             HANDLE_NAME(Quad)
@@ -319,7 +365,7 @@ bool Parser::parse() {
             if(name == "container") {
                 container = lexer.get_string();
 
-                if (!(container == "BVH" || container == "Naive")) {
+                if (!(container == "BVH" || container == "SAH" || container == "LBVH" || container == "SBVH" || container == "BVH4" || container == "Naive")) {
                     std::cerr << "parsing failed due to unknown container \"" << container << "\"" << std::endl;
                     return false;
                 }
@@ -357,10 +403,121 @@ void Parser::parse_ambient_light() {
     scene.ambient_light = {values[0],values[1],values[2]};
 }
 
+void Parser::parse_shadow_samples() {
+    int samples = static_cast<int>(lexer.get_number());
+    if (samples < 1) {
+        throw std::string("shadow_samples must be >= 1");
+    }
+    scene.shadow_samples = samples;
+}
+
+void Parser::parse_adaptive_shadows() {
+    // adaptive_shadows num_probes (0 désactive le mode)
+    int probes = static_cast<int>(lexer.get_number());
+    if (probes < 0 || probes > PACKET_MAX_RAYS) {
+        throw std::string("adaptive_shadows expects 0 <= num_probes <= ") + std::to_string(PACKET_MAX_RAYS);
+    }
+    scene.shadow_probes = probes;
+}
+
 void Parser::parse_max_ray_depth() {
     scene.max_ray_depth = static_cast<int>(lexer.get_number());
 }
 
+void Parser::parse_min_throughput() {
+    double value = lexer.get_number();
+    if (value < 0) {
+        throw std::string("min_throughput must be >= 0");
+    }
+    scene.min_throughput = value;
+}
+
+void Parser::parse_russian_roulette() {
+    // russian_roulette start_depth (0 désactive la roulette)
+    int depth = static_cast<int>(lexer.get_number());
+    if (depth < 0) {
+        throw std::string("russian_roulette expects a start depth >= 0");
+    }
+    scene.russian_roulette = depth > 0;
+    scene.roulette_depth = depth;
+}
+
+void Parser::parse_num_threads() {
+    scene.num_threads = static_cast<int>(lexer.get_number());
+}
+
+void Parser::parse_seed() {
+    scene.seed = static_cast<uint64_t>(lexer.get_number());
+}
+
+void Parser::parse_ray_packets() {
+    scene.ray_packets = lexer.get_number() != 0;
+}
+
+void Parser::parse_integrator() {
+    std::string name = lexer.get_string();
+    if (name == "recursive") {
+        scene.integrator = INTEGRATOR_RECURSIVE;
+    } else if (name == "wavefront") {
+        scene.integrator = INTEGRATOR_WAVEFRONT;
+    } else {
+        throw std::string("unknown integrator \"") + name + "\" (expected \"recursive\" or \"wavefront\")";
+    }
+}
+
+void Parser::parse_adaptive_sampling() {
+    // adaptive_sampling min_samples max_samples threshold
+    int min_samples = static_cast<int>(lexer.get_number());
+    int max_samples = static_cast<int>(lexer.get_number());
+    double threshold = lexer.get_number();
+    if (min_samples < 2 || max_samples < min_samples || threshold <= 0) {
+        throw std::string("adaptive_sampling expects 2 <= min_samples <= max_samples and threshold > 0");
+    }
+
+    scene.adaptive_sampling = true;
+    scene.adaptive_min_samples = min_samples;
+    scene.adaptive_max_samples = max_samples;
+    scene.adaptive_threshold = threshold;
+}
+
+void Parser::parse_frames() {
+    int frames = static_cast<int>(lexer.get_number());
+    if (frames < 1) {
+        throw std::string("frames must be >= 1");
+    }
+    scene.num_frames = frames;
+}
+
+void Parser::parse_rebuild_threshold() {
+    double value = lexer.get_number();
+    if (value < 0) {
+        throw std::string("rebuild_threshold must be >= 0");
+    }
+    scene.rebuild_threshold = value;
+}
+
+void Parser::parse_mesh_bvh() {
+    std::string method = lexer.get_string();
+    if (method == "SAH") {
+        ResourceManager::Instance()->mesh_split_method = SPLIT_SAH;
+    } else if (method == "SBVH") {
+        ResourceManager::Instance()->mesh_split_method = SPLIT_SBVH;
+    } else {
+        throw std::string("unknown mesh_bvh \"") + method + "\" (expected \"SAH\" or \"SBVH\")";
+    }
+}
+
+void Parser::parse_bvh_cache() {
+    ResourceManager::Instance()->bvh_cache_dir = lexer.get_string();
+}
+
+void Parser::parse_simd() {
+    std::string name = lexer.get_string();
+    if (!Simd::parse(name, &scene.simd)) {
+        throw std::string("unknown SIMD level \"") + name + "\" (expected \"auto\", \"scalar\" or \"avx2\")";
+    }
+}
+
 void Parser::parse_Perspective() {
     scene.camera.fovy = lexer.get_number();
     scene.camera.aspect = lexer.get_number();
@@ -386,7 +543,7 @@ void Parser::parse_Material() {
     lexer.get_string();
     bitmap_image m = lexer.get_bitmap();
     ParamList params = lexer.get_param_list(1, 4);
-    ResourceManager::Instance()->materials[name] = Material(m,params);
+    ResourceManager::Instance()->add_material(name, Material(m,params));
 
 }
 
@@ -409,7 +566,7 @@ void Parser::parse_Translate() {
     double x = lexer.get_number();
     double y = lexer.get_number();
     double z = lexer.get_number();
-    transform_stack.back() = mul(transform_stack.back(),linalg::translation_matrix(double3{x, y, z}));
+    push_transform(TransformOp{TRANSFORM_TRANSLATE, {TransformKey{0, {x, y, z, 0}}}});
 }
 
 
@@ -419,7 +576,7 @@ void Parser::parse_Scale() {
     double x = lexer.get_number();
     double y = lexer.get_number();
     double z = lexer.get_number();
-    transform_stack.back() = mul(transform_stack.back(),linalg::scaling_matrix(double3{x, y, z}));
+    push_transform(TransformOp{TRANSFORM_SCALE, {TransformKey{0, {x, y, z, 0}}}});
 }
 
 
@@ -430,8 +587,54 @@ void Parser::parse_Rotate() {
     double x = lexer.get_number();
     double y = lexer.get_number();
     double z = lexer.get_number();
+    push_transform(TransformOp{TRANSFORM_ROTATE, {TransformKey{0, {a, x, y, z}}}});
+}
+
+
+void Parser::parse_AnimatedTranslate() {
+    // AnimatedTranslate [frame x y z ...]
+    push_transform(parse_keyframes(TRANSFORM_TRANSLATE, 3));
+}
+
 
-    transform_stack.back() = mul(transform_stack.back(),linalg::rotation_matrix(linalg::rotation_quat(double3{x, y, z},deg2rad(a))));
+void Parser::parse_AnimatedScale() {
+    // AnimatedScale [frame x y z ...]
+    push_transform(parse_keyframes(TRANSFORM_SCALE, 3));
+}
+
+
+void Parser::parse_AnimatedRotate() {
+    // AnimatedRotate [frame angle x y z ...]
+    push_transform(parse_keyframes(TRANSFORM_ROTATE, 4));
+}
+
+
+TransformOp Parser::parse_keyframes(TransformOpType type, int num_params) {
+    std::vector<double> values = lexer.get_numbers(num_params + 1);
+    if (values.size() % (num_params + 1) != 0) {
+        throw std::string("keyframes expect ") + std::to_string(num_params + 1) + " numbers each";
+    }
+
+    TransformOp op{type, {}};
+    for (size_t i = 0; i < values.size(); i += num_params + 1) {
+        TransformKey key{values[i], {0, 0, 0, 0}};
+        std::copy(values.begin() + i + 1, values.begin() + i + 1 + num_params, key.params);
+        if (!op.keys.empty() && !(key.frame > op.keys.back().frame)) {
+            throw std::string("keyframes must be in increasing frame order");
+        }
+        op.keys.push_back(key);
+    }
+    return op;
+}
+
+
+void Parser::push_transform(const TransformOp& op) {
+    // La matrice courante est celle de la première image ; les opérations sont conservées
+    // pour les objets animés.
+    TransformState& state = transform_stack.back();
+    state.matrix = mul(state.matrix, op.evaluate(0));
+    state.ops.push_back(op);
+    state.animated = state.animated || op.animated();
 }
 
 
@@ -469,13 +672,11 @@ void Parser::parse_Mesh() {
         filename = lexer.get_string();
         std::cout << "got OBJ filename \"" << filename << "\"" << std::endl;
 
-        std::ifstream file(filename.c_str());
-        if (!file.good()) {
-            throw std::string("Unable to open OBJ file: ") + filename;
-        }
-
-        Mesh *obj = new Mesh(file);
-        std::cout << obj->triangles.size() << " triangles" << std::endl;
+        // Chaque fichier n'est lu qu'une fois ; les placements suivants ne créent qu'une instance.
+        bool cached = ResourceManager::Instance()->meshes.count(filename) > 0;
+        Mesh *obj = new Mesh(ResourceManager::Instance()->load_mesh(filename));
+        std::cout << obj->data->triangles.size() << " triangles"
+                  << (cached ? " (shared instance)" : "") << std::endl;
 
         finish_object(obj);
     } catch (std::string e) {
@@ -491,15 +692,18 @@ void Parser::finish_object(Object *obj) {
 
     // Get the material name, and make sure that material exists.
     std::string material_name = lexer.get_string();
-    if (!ResourceManager::Instance()->materials.count(material_name)) {
+    if (!ResourceManager::Instance()->find_material(material_name, &obj->material)) {
         std::stringstream ss;
         ss << "no material \"" << material_name << "\"" << std::endl;
         throw(ss.str());
     }
-    obj->key_material = material_name;
 
     // Set transform, inv transform, and normal transform.
-    obj->setup_transform(transform_stack.back());
+    const TransformState& state = transform_stack.back();
+    obj->setup_transform(state.matrix);
+    if (state.animated) {
+        scene.animations.push_back(ObjectAnimation{obj, state.ops});
+    }
 
     // Add to the list of objects.
     objects.push_back(obj);
@@ -511,6 +715,9 @@ void Parser::parse_SphericalLight() {
     position[1] = lexer.get_number();
     position[2] = lexer.get_number();
     ParamList params = lexer.get_param_list(1,4);
+    if (params["shadow_samples"].size() == 1 && params["shadow_samples"][0] < 1) {
+        throw std::string("SphericalLight shadow_samples must be >= 1");
+    }
 
     scene.lights.push_back(SphericalLight(position, params));
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 #include "container.h"
 
 #include "resource_manager.h"
+#include "animation.h"
 
 #include "linalg/linalg.h"
 using namespace linalg::aliases;
@@ -108,12 +109,20 @@ private:
 };
 
 
+// Entrée de la pile de transformations : la matrice courante, et les opérations qui la composent
+// afin de pouvoir la réévaluer à chaque image si l'une d'elles est animée.
+struct TransformState {
+    double4x4 matrix;
+    std::vector<TransformOp> ops;
+    bool animated;
+};
+
 class Parser
 {
 private:
     Lexer lexer; // Le lexer utilisé pour séparer le fichier en tokens.
 
-    std::vector<double4x4> transform_stack;  // Pile de transformations.
+    std::vector<TransformState> transform_stack;  // Pile de transformations.
 
     std::vector<Object*> objects;
 
@@ -125,7 +134,23 @@ private:
     void parse_samples_per_pixel();
     void parse_jitter_radius();
     void parse_ambient_light();
+    void parse_shadow_samples();
+    void parse_adaptive_shadows();
     void parse_max_ray_depth();
+    void parse_min_throughput();
+    void parse_russian_roulette();
+    void parse_num_threads();
+    void parse_seed();
+    void parse_simd();
+    void parse_ray_packets();
+    void parse_integrator();
+    void parse_adaptive_sampling();
+    void parse_frames();
+    void parse_rebuild_threshold();
+    // Méthode du BVH local des maillages déclarés ensuite : "SAH" (défaut) ou "SBVH".
+    void parse_mesh_bvh();
+    // Dossier du cache disque des BVH (p. ex. "data/cache") ; doit précéder les Mesh à mettre en cache.
+    void parse_bvh_cache();
 
     //Argument pour la caméra
     void parse_Perspective();
@@ -141,6 +166,17 @@ private:
     void parse_Rotate();
     void parse_Scale();
 
+    // Versions animées : un tableau d'images clés [image params... image params...].
+    void parse_AnimatedTranslate();
+    void parse_AnimatedRotate();
+    void parse_AnimatedScale();
+
+    // Compose op à la transformation courante.
+    void push_transform(const TransformOp& op);
+
+    // Lit les images clés d'une opération animée ; num_params nombres suivent chaque image.
+    TransformOp parse_keyframes(TransformOpType type, int num_params);
+
     void parse_Sphere();
     void parse_Quad();
     void parse_Cylinder();
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cmath>
+
+#include "primitive_store.h"
+
+#if RAY_HAS_AVX2_KERNELS
+namespace {
+    typedef uint32_t (*PackKernel)(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t);
+
+    // Équivalent de PrimitiveKernels::intersect sur les paquets d'une suite : les voies retenues par
+    // le noyau sont acceptées dans l'ordre, contre la profondeur la plus proche courante.
+    // inclusive : la borne t_max est acceptée (Quad::local_intersect), sinon elle est stricte.
+    template <class T>
+    bool intersect_packed(const PrimitivePack4* packs, T* prims, int count, PackKernel kernel, bool inclusive,
+                          const Ray& ray, double t_min, double* closest, HitRecord* record) {
+        bool hit_found = false;
+        for (int base = 0; base < count; base += PRIMITIVE_PACK_WIDTH) {
+            const PrimitivePack4& pack = packs[base / PRIMITIVE_PACK_WIDTH];
+            STAT_ADD(STAT_PRIMITIVE_PACKS_TESTED, 1);
+            STAT_ADD(STAT_PRIMITIVES_TESTED, pack.count);
+
+            double t[PRIMITIVE_PACK_WIDTH];
+            uint32_t mask = kernel(pack, ray, t_min, *closest, t);
+            for (int lane = 0; lane < pack.count; lane++) {
+                if (!(mask & (1u << lane)) || (inclusive ? t[lane] > *closest : !(t[lane] < *closest))) {
+                    continue;
+                }
+                HitRecord lane_record;
+                lane_record.depth = t[lane];
+                lane_record.object = &prims[base + lane];
+                *record = lane_record;
+                *closest = t[lane];
+                hit_found = true;
+            }
+        }
+        return hit_found;
+    }
+
+    bool occluded_packed(const PrimitivePack4* packs, int count, PackKernel kernel,
+                         const Ray& ray, double t_min, double t_max) {
+        for (int base = 0; base < count; base += PRIMITIVE_PACK_WIDTH) {
+            const PrimitivePack4& pack = packs[base / PRIMITIVE_PACK_WIDTH];
+            STAT_ADD(STAT_PRIMITIVE_PACKS_TESTED, 1);
+            STAT_ADD(STAT_PRIMITIVES_TESTED, pack.count);
+
+            double t[PRIMITIVE_PACK_WIDTH];
+            if (kernel(pack, ray, t_min, t_max, t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Paramètres propres au type d'une voie, avec les mêmes expressions que local_intersect.
+    void set_lane_params(PrimitivePack4* pack, int lane, const Sphere& sphere) {
+        pack->radius2[lane] = pow(sphere.radius, 2);
+    }
+
+    void set_lane_params(PrimitivePack4* pack, int lane, const Quad& quad) {
+        pack->extent[lane] = quad.half_size;
+    }
+
+    void set_lane_params(PrimitivePack4* pack, int lane, const Cylinder& cylinder) {
+        pack->radius2[lane] = pow(cylinder.radius, 2);
+        pack->extent[lane] = cylinder.half_height;
+    }
+
+    // Ajoute à packs les paquets des count primitives prims.
+    template <class T>
+    void append_packs(const T* prims, int count, std::vector<PrimitivePack4>* packs) {
+        for (int base = 0; base < count; base += PRIMITIVE_PACK_WIDTH) {
+            PrimitivePack4 pack = {};
+            pack.count = std::min(PRIMITIVE_PACK_WIDTH, count - base);
+            for (int lane = 0; lane < pack.count; lane++) {
+                const T& prim = prims[base + lane];
+                for (int col = 0; col < 4; col++) {
+                    for (int row = 0; row < 3; row++) {
+                        pack.i_transform[col][row][lane] = prim.i_transform[col][row];
+                    }
+                }
+                set_lane_params(&pack, lane, prim);
+            }
+            packs->push_back(pack);
+        }
+    }
+}
+#endif
+
+void PrimitiveStore::build(const std::vector<Object*>& objects, std::vector<BVHObjectInfo>& infos, const BVHTree& tree) {
+    spheres.clear();
+    quads.clear();
+    cylinders.clear();
+    meshes.clear();
+    refs.clear();
+    sources.clear();
+
+    auto type_of = [&](const BVHObjectInfo& info) { return objects[info.idx]->primitive_type(); };
+
+    // Regroupe les objets de chaque feuille par type ; l'ordre relatif d'un même type est conservé.
+    for (const LinearBVHNode& node : tree.nodes) {
+        if (node.n_primitives == 0) {
+            continue;
+        }
+        auto begin = infos.begin() + node.primitives_offset;
+        std::stable_sort(begin, begin + node.n_primitives, [&](const BVHObjectInfo& a, const BVHObjectInfo& b) {
+            return type_of(a) < type_of(b);
+        });
+    }
+
+    int type_counts[PRIMITIVE_TYPE_COUNT] = {};
+    for (auto& info : infos) {
+        type_counts[type_of(info)]++;
+    }
+    spheres.reserve(type_counts[PRIMITIVE_SPHERE]);
+    quads.reserve(type_counts[PRIMITIVE_QUAD]);
+    cylinders.reserve(type_counts[PRIMITIVE_CYLINDER]);
+    meshes.reserve(type_counts[PRIMITIVE_MESH]);
+
+    // Les tableaux sont remplis dans l'ordre des feuilles : une suite du même type dans une feuille
+    // occupe des indices consécutifs.
+    refs.reserve(infos.size());
+    sources.reserve(infos.size());
+    for (auto& info : infos) {
+        Object* obj = objects[info.idx];
+        sources.push_back(obj);
+        PrimitiveRef ref = {};
+        ref.type = static_cast<uint8_t>(obj->primitive_type());
+        switch (obj->primitive_type()) {
+            case PRIMITIVE_SPHERE:
+                ref.index = static_cast<uint32_t>(spheres.size());
+                spheres.push_back(*static_cast<Sphere*>(obj));
+                break;
+            case PRIMITIVE_QUAD:
+                ref.index = static_cast<uint32_t>(quads.size());
+                quads.push_back(*static_cast<Quad*>(obj));
+                break;
+            case PRIMITIVE_CYLINDER:
+                ref.index = static_cast<uint32_t>(cylinders.size());
+                cylinders.push_back(*static_cast<Cylinder*>(obj));
+                break;
+            case PRIMITIVE_MESH:
+                ref.index = static_cast<uint32_t>(meshes.size());
+                meshes.push_back(*static_cast<Mesh*>(obj));
+                break;
+            default:
+                break;
+        }
+        refs.push_back(ref);
+    }
+
+    // Longueur des suites, calculée à rebours dans chaque feuille.
+    for (const LinearBVHNode& node : tree.nodes) {
+        int first = node.primitives_offset;
+        for (int i = first + node.n_primitives - 1; i >= first; i--) {
+            bool continues = i + 1 < first + node.n_primitives && refs[i + 1].type == refs[i].type;
+            refs[i].run = continues ? refs[i + 1].run + 1 : 1;
+        }
+    }
+
+    build_packs();
+}
+
+void PrimitiveStore::build_packs() {
+    sphere_packs.clear();
+    quad_packs.clear();
+    cylinder_packs.clear();
+    run_pack.assign(refs.size(), -1);
+#if RAY_HAS_AVX2_KERNELS
+    if (!Simd::avx2_supported()) {
+        return;
+    }
+
+    // Une suite commence à la première référence ou lorsque la précédente termine la sienne.
+    for (int i = 0; i < static_cast<int>(refs.size()); i++) {
+        bool starts_run = i == 0 || refs[i - 1].run == 1;
+        const PrimitiveRef& ref = refs[i];
+        if (!starts_run || ref.run < 2) {
+            continue;
+        }
+        switch (ref.type) {
+            case PRIMITIVE_SPHERE:
+                run_pack[i] = static_cast<int32_t>(sphere_packs.size());
+                append_packs(&spheres[ref.index], ref.run, &sphere_packs);
+                break;
+            case PRIMITIVE_QUAD:
+                run_pack[i] = static_cast<int32_t>(quad_packs.size());
+                append_packs(&quads[ref.index], ref.run, &quad_packs);
+                break;
+            case PRIMITIVE_CYLINDER:
+                run_pack[i] = static_cast<int32_t>(cylinder_packs.size());
+                append_packs(&cylinders[ref.index], ref.run, &cylinder_packs);
+                break;
+            default:
+                break;
+        }
+    }
+#endif
+}
+
+void PrimitiveStore::update_objects() {
+    for (int i = 0; i < static_cast<int>(refs.size()); i++) {
+        const PrimitiveRef& ref = refs[i];
+        switch (ref.type) {
+            case PRIMITIVE_SPHERE:
+                spheres[ref.index] = *static_cast<Sphere*>(sources[i]);
+                break;
+            case PRIMITIVE_QUAD:
+                quads[ref.index] = *static_cast<Quad*>(sources[i]);
+                break;
+            case PRIMITIVE_CYLINDER:
+                cylinders[ref.index] = *static_cast<Cylinder*>(sources[i]);
+                break;
+            case PRIMITIVE_MESH:
+                meshes[ref.index] = *static_cast<Mesh*>(sources[i]);
+                break;
+        }
+    }
+    build_packs();
+}
+
+Object* PrimitiveStore::object(int i) {
+    const PrimitiveRef& ref = refs[i];
+    switch (ref.type) {
+        case PRIMITIVE_SPHERE:
+            return &spheres[ref.index];
+        case PRIMITIVE_QUAD:
+            return &quads[ref.index];
+        case PRIMITIVE_CYLINDER:
+            return &cylinders[ref.index];
+        default:
+            return &meshes[ref.index];
+    }
+}
+
+AABB PrimitiveStore::bounds(int first, int count) {
+    AABB aabb = object(first)->compute_aabb();
+    for (int i = first + 1; i < first + count; i++) {
+        aabb = combine(aabb, object(i)->compute_aabb());
+    }
+    return aabb;
+}
+
+bool PrimitiveStore::intersect(int first, int count, const Ray& ray, double t_min, double* closest, HitRecord* record) {
+    bool hit_found = false;
+    for (int i = first; i < first + count; i += refs[i].run) {
+        const PrimitiveRef& ref = refs[i];
+        bool found = false;
+#if RAY_HAS_AVX2_KERNELS
+        if (run_pack[i] >= 0 && Simd::active() == SIMD_AVX2) {
+            switch (ref.type) {
+                case PRIMITIVE_SPHERE:
+                    found = intersect_packed(&sphere_packs[run_pack[i]], &spheres[ref.index], ref.run,
+                                             intersect_spheres4_avx2, false, ray, t_min, closest, record);
+                    break;
+                case PRIMITIVE_QUAD:
+                    found = intersect_packed(&quad_packs[run_pack[i]], &quads[ref.index], ref.run,
+                                             intersect_quads4_avx2, true, ray, t_min, closest, record);
+                    break;
+                case PRIMITIVE_CYLINDER:
+                    found = intersect_packed(&cylinder_packs[run_pack[i]], &cylinders[ref.index], ref.run,
+                                             intersect_cylinders4_avx2, false, ray, t_min, closest, record);
+                    break;
+            }
+            hit_found = hit_found || found;
+            continue;
+        }
+#endif
+        switch (ref.type) {
+            case PRIMITIVE_SPHERE:
+                found = PrimitiveKernels::intersect(&spheres[ref.index], ref.run, ray, t_min, closest, record);
+                break;
+            case PRIMITIVE_QUAD:
+                found = PrimitiveKernels::intersect(&quads[ref.index], ref.run, ray, t_min, closest, record);
+                break;
+            case PRIMITIVE_CYLINDER:
+                found = PrimitiveKernels::intersect(&cylinders[ref.index], ref.run, ray, t_min, closest, record);
+                break;
+            case PRIMITIVE_MESH:
+                found = PrimitiveKernels::intersect(&meshes[ref.index], ref.run, ray, t_min, closest, record);
+                break;
+        }
+        hit_found = hit_found || found;
+    }
+    return hit_found;
+}
+
+bool PrimitiveStore::occluded(int first, int count, const Ray& ray, double t_min, double t_max) {
+    for (int i = first; i < first + count; i += refs[i].run) {
+        const PrimitiveRef& ref = refs[i];
+        bool blocked = false;
+#if RAY_HAS_AVX2_KERNELS
+        if (run_pack[i] >= 0 && Simd::active() == SIMD_AVX2) {
+            switch (ref.type) {
+                case PRIMITIVE_SPHERE:
+                    blocked = occluded_packed(&sphere_packs[run_pack[i]], ref.run, intersect_spheres4_avx2, ray, t_min, t_max);
+                    break;
+                case PRIMITIVE_QUAD:
+                    blocked = occluded_packed(&quad_packs[run_pack[i]], ref.run, intersect_quads4_avx2, ray, t_min, t_max);
+                    break;
+                case PRIMITIVE_CYLINDER:
+                    blocked = occluded_packed(&cylinder_packs[run_pack[i]], ref.run, intersect_cylinders4_avx2, ray, t_min, t_max);
+                    break;
+            }
+            if (blocked) {
+                return true;
+            }
+            continue;
+        }
+#endif
+        switch (ref.type) {
+            case PRIMITIVE_SPHERE:
+                blocked = PrimitiveKernels::occluded(&spheres[ref.index], ref.run, ray, t_min, t_max);
+                break;
+            case PRIMITIVE_QUAD:
+                blocked = PrimitiveKernels::occluded(&quads[ref.index], ref.run, ray, t_min, t_max);
+                break;
+            case PRIMITIVE_CYLINDER:
+                blocked = PrimitiveKernels::occluded(&cylinders[ref.index], ref.run, ray, t_min, t_max);
+                break;
+            case PRIMITIVE_MESH:
+                blocked = PrimitiveKernels::occluded(&meshes[ref.index], ref.run, ray, t_min, t_max);
+                break;
+        }
+        if (blocked) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "object.h"
+#include "bvh.h"
+#include "simd.h"
+
+// Référence compacte (8 octets) à une primitive du PrimitiveStore.
+struct PrimitiveRef {
+    // Indice dans le tableau du type de la primitive.
+    uint32_t index;
+    // Nombre de primitives consécutives du même type à partir de celle-ci dans la feuille.
+    uint16_t run;
+    // PrimitiveType de la primitive.
+    uint8_t type;
+    uint8_t pad;
+};
+static_assert(sizeof(PrimitiveRef) == 8, "PrimitiveRef doit occuper 8 octets");
+
+// Stockage orienté données des objets d'un BVH : une copie de chaque objet dans un tableau
+// contigu par type, rangé dans l'ordre des feuilles.
+// Dans chaque feuille, les objets sont regroupés par type ; une suite de primitives du même type
+// correspond donc à une plage contiguë d'un seul tableau, testée par un noyau PrimitiveKernels
+// choisi par un switch, sans appel virtuel par candidat.
+class PrimitiveStore {
+public:
+    std::vector<Sphere> spheres;
+    std::vector<Quad> quads;
+    std::vector<Cylinder> cylinders;
+    std::vector<Mesh> meshes;
+
+    // Une référence par objet, dans l'ordre des feuilles de l'arbre.
+    std::vector<PrimitiveRef> refs;
+
+    // Objet de la scène copié par chaque référence (pour les mises à jour des objets animés).
+    std::vector<Object*> sources;
+
+    // Suites d'au moins deux sphères, quads ou cylindres d'une feuille, regroupées en paquets SoA
+    // pour les noyaux AVX2 (vides sans support AVX2). Les paquets d'une suite sont consécutifs.
+    std::vector<PrimitivePack4> sphere_packs;
+    std::vector<PrimitivePack4> quad_packs;
+    std::vector<PrimitivePack4> cylinder_packs;
+
+    // Indice du premier paquet d'une suite, indexé par la référence qui commence la suite (-1 sinon).
+    std::vector<int32_t> run_pack;
+
+    // Copie les objets dans les tableaux par type. infos est l'ordre des feuilles de tree (voir
+    // BVHTree::build) ; chaque feuille y est triée par type, de façon stable.
+    // Les HitRecord produits pointent vers les copies : le stockage ne doit plus être modifié ensuite.
+    void build(const std::vector<Object*>& objects, std::vector<BVHObjectInfo>& infos, const BVHTree& tree);
+
+    // Remplit les paquets et run_pack à partir des suites de refs.
+    void build_packs();
+
+    // Recopie les objets de la scène (transformations animées) sans changer l'ordre des références,
+    // puis remplit à nouveau les paquets.
+    void update_objects();
+
+    // Copie de l'objet de la référence i.
+    Object* object(int i);
+
+    // Boîte englobante des primitives refs[first, first + count).
+    AABB bounds(int first, int count);
+
+    // Intersection la plus proche parmi les primitives refs[first, first + count) dans [t_min, *closest].
+    bool intersect(int first, int count, const Ray& ray, double t_min, double* closest, HitRecord* record);
+
+    // Vrai dès qu'une des primitives refs[first, first + count) bloque le rayon dans [t_min, t_max].
+    bool occluded(int first, int count, const Ray& ray, double t_min, double t_max);
+};
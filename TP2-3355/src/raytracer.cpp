@@ -10,10 +10,14 @@
 #include <sstream>
 #include <map>
 #include <vector>
+#include <atomic>
+#include <mutex>
 
 #include "raytracer.h"
 #include "scene.h"
 #include "frame.h"
+#include "thread_pool.h"
+#include "stats.h"
 #include <math.h>
 
 void Raytracer::render(const Scene& scene, Frame* output)
@@ -28,15 +32,12 @@ void Raytracer::render(const Scene& scene, Frame* output)
 	// @@@@@@ VOTRE CODE ICI
 	// Calculez les paramètres de la caméra pour les rayons.
 		double3 forward = normalize(scene.camera.center - scene.camera.position); // z-direction of the camera 
-	    double3 right = cross(forward, scene.camera.up); // x-direction of the camera 
+	    double3 right = normalize(cross(forward, scene.camera.up)); // x-direction of the camera 
 		double3 up = cross(right, forward); // y-direction of the camera 
 
-		double aspect_ratio = static_cast<double>(scene.resolution[0]) / scene.resolution[1];
-		
-		double alpha = scene.camera.z_near / forward[2];
-		
-		double3 centerPOV = scene.camera.position - alpha * forward; // Position of the center of the projection plane
-		double heightPOV = 2 * alpha * tan(0.5 * deg2rad(scene.camera.fovy)); // Height of the projection plane
+		// The projection plane lies at z_near along forward, whatever the orientation of the camera.
+		double3 centerPOV = scene.camera.position + scene.camera.z_near * forward; // Position of the center of the projection plane
+		double heightPOV = 2 * scene.camera.z_near * tan(0.5 * deg2rad(scene.camera.fovy)); // Height of the projection plane
 		double widthPOV = heightPOV * scene.camera.aspect; // Width of the projection plane
 		
 		double pixelWidth = widthPOV / scene.resolution[0];  // Width of a pixel according to the camera (screen width / resolution in x [number of pixels in width])
@@ -45,56 +46,219 @@ void Raytracer::render(const Scene& scene, Frame* output)
 		double3 bottomLeftCornerPOV = centerPOV - 0.5 * heightPOV * up - 0.5 * widthPOV * right; // Bottom-left corner of the projection plane
 		bottomLeftCornerPOV += 0.5 * pixelWidth * right + 0.5 * pixelHeight * up; // Offset to be at the center of the pixel
 
+	CameraBasis basis{right, up, bottomLeftCornerPOV, pixelWidth, pixelHeight};
 
-    // Itère sur tous les pixels de l'image.
-    for(int y = 0; y < scene.resolution[1]; y++) {
-		if (y % 40){
-			std::cout << "\rScanlines completed: " << y << "/" << scene.resolution[1] << '\r';
-		}
+    // Découpe l'image en tuiles. Les tuiles sont soumises dans l'ordre des lignes, puis
+    // redistribuées dynamiquement par vol de travail entre les fils.
+    std::vector<Tile> tiles;
+    for(int y = 0; y < scene.resolution[1]; y += TILE_SIZE) {
+        for(int x = 0; x < scene.resolution[0]; x += TILE_SIZE) {
+            tiles.push_back(Tile{x, y,
+                                 std::min(x + TILE_SIZE, scene.resolution[0]),
+                                 std::min(y + TILE_SIZE, scene.resolution[1])});
+        }
+    }
+
+    SimdLevel simd = Simd::set_active(scene.simd);
+    if (scene.simd == SIMD_AVX2 && simd != SIMD_AVX2) {
+        std::cerr << "AVX2 is not supported on this machine; using scalar kernels." << std::endl;
+    }
+    std::cout << "SIMD kernels: " << Simd::name(simd) << std::endl;
+
+    // Chaque rendu (chaque image d'une séquence) rapporte ses propres compteurs.
+    Stats::reset();
+
+    ThreadPool pool(scene.num_threads);
+    std::vector<RenderThreadState> states(pool.size());
+
+    if (scene.integrator == INTEGRATOR_WAVEFRONT) {
+        render_wavefront(scene, basis, pool, output, z_buffer, states);
+    } else {
+        std::atomic<int> tiles_completed{0};
+        std::mutex progress_mutex;
+
+        parallel_for(pool, static_cast<int>(tiles.size()), [&](int itile, int ithread) {
+            RenderThreadState& state = states[ithread];
+            render_tile(scene, basis, tiles[itile], output, z_buffer, &state);
+            state.tiles++;
+
+            int completed = ++tiles_completed;
+            if (completed % 40 == 0 || completed == static_cast<int>(tiles.size())) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                std::cout << "\rTiles completed: " << completed << "/" << tiles.size() << std::flush;
+            }
+        });
+        std::cout << std::endl;
+    }
+
+    if (scene.adaptive_sampling) {
+        long long primary_rays = 0;
+        for (const RenderThreadState& state : states) {
+            primary_rays += state.primary_rays;
+        }
+        std::cout << "Adaptive sampling: "
+                  << static_cast<double>(primary_rays) / (scene.resolution[0] * scene.resolution[1])
+                  << " samples per pixel on average (" << scene.adaptive_min_samples << " to "
+                  << scene.adaptive_max_samples << ")" << std::endl;
+    }
+
+    if (scene.integrator != INTEGRATOR_WAVEFRONT) {
+        std::cout << "Rendered with " << pool.size() << " thread(s):";
+        for (int ithread = 0; ithread < pool.size(); ithread++) {
+            std::cout << " [" << ithread << "] " << states[ithread].tiles << " tiles";
+        }
+        std::cout << std::endl;
+    }
 
-        for(int x = 0; x < scene.resolution[0]; x++) {
+#if RAY_STATS
+    std::cout << "Statistics:" << std::endl;
+    Stats::report(std::cout);
+#endif
 
-			int avg_z_depth = 0;
-			double3 avg_ray_color{0,0,0};
+    delete[] z_buffer;
+}
+
+void Raytracer::render_tile(const Scene& scene, const CameraBasis& basis, const Tile& tile,
+                            Frame* output, double* z_buffer, RenderThreadState* state)
+{
+	// En mode adaptatif, on échantillonne jusqu'à ce que la variance de la luminance
+	// du pixel soit assez faible, entre adaptive_min_samples et adaptive_max_samples.
+	int max_samples = scene.adaptive_sampling ? scene.adaptive_max_samples
+	                                          : static_cast<int>(std::ceil(scene.samples_per_pixel));
+
+	// Les pixels sont traités par blocs de PACKET_WIDTH x PACKET_WIDTH : les rayons primaires
+	// d'un même échantillon forment un paquet qui traverse le BVH ensemble.
+    for(int by = tile.y0; by < tile.y1; by += PACKET_WIDTH) {
+        for(int bx = tile.x0; bx < tile.x1; bx += PACKET_WIDTH) {
+			int block_width = std::min(PACKET_WIDTH, tile.x1 - bx);
+			int block_height = std::min(PACKET_WIDTH, tile.y1 - by);
+			int block_size = block_width * block_height;
+
+			PixelAccumulator pixels[PACKET_MAX_RAYS];
 			
-			for(int iray = 0; iray < scene.samples_per_pixel; iray++) {
-				// Génère le rayon approprié pour ce pixel.
-				Ray ray;
-				// Initialise la profondeur de récursivité du rayon.
-				int ray_depth = 0;
-				// Initialize la couleur du rayon
-				double3 ray_color{0,0,0};
-
-				// @@@@@@ VOTRE CODE ICI
-				// Mettez en place le rayon primaire en utilisant les paramètres de la caméra.
-				// Lancez le rayon de manière uniformément aléatoire à l'intérieur du pixel dans la zone délimité par jitter_radius. 
-				// Faites la moyenne des différentes couleurs obtenues suite à la récursion.
-				
-				double3 pixel_center = bottomLeftCornerPOV + x * pixelWidth * right - y * pixelHeight * up;
-				ray = Ray(scene.camera.position, normalize(pixel_center - scene.camera.position));
-				double depth = scene.camera.z_far;
-
-				trace(scene, ray, ray_depth, &ray_color, &depth);
-				
-			}
+			for(int iray = 0; iray < max_samples; iray++) {
+				// Génère les rayons appropriés pour les pixels du bloc qui ont encore besoin d'échantillons.
+				RayPacket packet;
+				packet.t_min = EPSILON;
+				int ray_pixel[PACKET_MAX_RAYS];
+				Sampler samplers[PACKET_MAX_RAYS];
+
+				for (int ipixel = 0; ipixel < block_size; ipixel++) {
+					if (pixels[ipixel].done) {
+						continue;
+					}
+					int x = bx + ipixel % block_width;
+					int y = by + ipixel / block_width;
+
+					// @@@@@@ VOTRE CODE ICI
+					// Mettez en place le rayon primaire en utilisant les paramètres de la caméra.
+					// Lancez le rayon de manière uniformément aléatoire à l'intérieur du pixel dans la zone délimité par jitter_radius. 
+					// Faites la moyenne des différentes couleurs obtenues suite à la récursion.
+					
+					// Chaque échantillon possède ses propres flux aléatoires, indépendants du fil et de l'ordre des tuiles.
+					Sampler& sampler = samplers[packet.count];
+					sampler = Sampler(scene.seed, x + y * scene.resolution[0], iray);
+					packet.rays[packet.count] = camera_ray(scene, basis, x, y, sampler);
+					packet.t_max[packet.count] = scene.camera.z_far;
+					ray_pixel[packet.count] = ipixel;
+					packet.count++;
+				}
+
+				if (packet.count == 0) {
+					break;
+				}
+
+				Intersection hits[PACKET_MAX_RAYS];
+				bool hit_found[PACKET_MAX_RAYS];
+				intersect_rays(scene, packet, hits, hit_found);
 
-			avg_z_depth = avg_z_depth / scene.samples_per_pixel;
-			avg_ray_color = avg_ray_color / scene.samples_per_pixel;
+				for (int i = 0; i < packet.count; i++) {
+					// Initialise la profondeur de récursivité du rayon.
+					int ray_depth = 0;
+					// Initialize la couleur du rayon
+					double3 ray_color{0,0,0};
+					double depth = scene.camera.z_far;
 
-			// Test de profondeur
-			if(avg_z_depth >= scene.camera.z_near && avg_z_depth <= scene.camera.z_far && 
-				avg_z_depth < z_buffer[x + y*scene.resolution[0]]) {
-				z_buffer[x + y*scene.resolution[0]] = avg_z_depth;
+					if (hit_found[i]) {
+						trace_hit(scene, packet.rays[i], hits[i], ray_depth, samplers[i], &ray_color, &depth);
+					}
+					state->primary_rays++;
 
-				// Met à jour la couleur de l'image (et sa profondeur)
-				output->set_color_pixel(x, y, avg_ray_color);
-				output->set_depth_pixel(x, y, (avg_z_depth - scene.camera.z_near) / 
-										(scene.camera.z_far-scene.camera.z_near));
+					add_sample(scene, &pixels[ray_pixel[i]], ray_color, depth);
+				}
+			}
+
+			for (int ipixel = 0; ipixel < block_size; ipixel++) {
+				int x = bx + ipixel % block_width;
+				int y = by + ipixel / block_width;
+				resolve_pixel(scene, x, y, pixels[ipixel], output, z_buffer);
 			}
         }
     }
+}
 
-    delete[] z_buffer;
+Ray Raytracer::camera_ray(const Scene& scene, const CameraBasis& basis, int x, int y, Sampler& sampler)
+{
+	double2 jitter = scene.jitter_radius * (2.0 * sampler.next_2d() - 1.0);
+	double3 pixel_center = basis.bottom_left + (x + jitter.x) * basis.pixel_width * basis.right
+	                                         + (y + jitter.y) * basis.pixel_height * basis.up;
+	return Ray(scene.camera.position, normalize(pixel_center - scene.camera.position));
+}
+
+void Raytracer::intersect_rays(const Scene& scene, const RayPacket& packet, Intersection* hits, bool* hit_found)
+{
+	if (scene.ray_packets) {
+		scene.container->intersect_packet(packet, hits, hit_found);
+	} else {
+		for (int i = 0; i < packet.count; i++) {
+			hit_found[i] = scene.container->intersect(packet.rays[i], packet.t_min, packet.t_max[i], &hits[i]);
+		}
+	}
+}
+
+void Raytracer::occluded_rays(const Scene& scene, const RayPacket& packet, bool* occluded)
+{
+	if (scene.ray_packets) {
+		scene.container->occluded_packet(packet, occluded);
+	} else {
+		for (int i = 0; i < packet.count; i++) {
+			occluded[i] = scene.container->occluded(packet.rays[i], packet.t_min, packet.t_max[i]);
+		}
+	}
+}
+
+void Raytracer::add_sample(const Scene& scene, PixelAccumulator* pixel, double3 color, double z_depth)
+{
+	pixel->color += color;
+	pixel->z_depth += z_depth;
+	pixel->nsamples++;
+
+	if (scene.adaptive_sampling) {
+		pixel->variance.add(dot(color, double3{0.2126, 0.7152, 0.0722}));
+		if (pixel->nsamples >= scene.adaptive_min_samples && pixel->variance.converged(scene.adaptive_threshold)) {
+			pixel->done = true;
+		}
+	}
+}
+
+void Raytracer::resolve_pixel(const Scene& scene, int x, int y, const PixelAccumulator& pixel,
+                              Frame* output, double* z_buffer)
+{
+	double avg_z_depth = pixel.z_depth / pixel.nsamples;
+	double3 avg_ray_color = pixel.color / pixel.nsamples;
+	output->set_samples_pixel(x, y, pixel.nsamples);
+
+	// Test de profondeur
+	// Chaque pixel n'est résolu qu'une seule fois : aucune synchronisation n'est requise.
+	if(avg_z_depth >= scene.camera.z_near && avg_z_depth <= scene.camera.z_far && 
+		avg_z_depth < z_buffer[x + y*scene.resolution[0]]) {
+		z_buffer[x + y*scene.resolution[0]] = avg_z_depth;
+
+		// Met à jour la couleur de l'image (et sa profondeur)
+		output->set_color_pixel(x, y, avg_ray_color);
+		output->set_depth_pixel(x, y, (avg_z_depth - scene.camera.z_near) / 
+								(scene.camera.z_far-scene.camera.z_near));
+	}
 }
 
 // @@@@@@ VOTRE CODE ICI
@@ -108,62 +272,125 @@ void Raytracer::render(const Scene& scene, Frame* output)
 //            pour la couleur de sortie.
 //          - Mettre à jour la nouvelle profondeure.
 void Raytracer::trace(const Scene& scene,
-					  Ray ray, int ray_depth,
+					  Ray ray, int ray_depth, Sampler& sampler,
 					  double3* out_color, double* out_z_depth)
 {
 	Intersection hit;
 	// Fait appel à l'un des containers spécifiées.
 	if(scene.container->intersect(ray,EPSILON,*out_z_depth,&hit)) {		
-		Material& material = ResourceManager::Instance()->materials[hit.key_material];
-		
-		// @@@@@@ VOTRE CODE ICI
-		// Déterminer la couleur associée à la réflection d'un rayon de manière récursive.
-				
-		// Reflection
-		if (!(abs(material.k_reflection) < EPSILON) && (ray_depth < MAX_DEPTH)) { // if reflected
-		    for (auto lightIter = scene.lights.begin(); lightIter != scene.lights.end(); lightIter++) {
-				double3 reflected_color{0, 0 ,0};
-				double3 v_i = ray.origin - ray.direction; // inverse direction of the ray
-				double3 reflected_ray = 2 * linalg::dot(v_i, hit.normal) * hit.normal - v_i;
-						
-				Ray reflected_lightRay = Ray(hit.position + EPSILON * hit.normal, reflected_ray);
-				double reflected_z_depth = scene.camera.z_far;
-
-				if (ray_depth < scene.max_ray_depth) {
-					trace(scene, reflected_lightRay, ray_depth++, &reflected_color, &reflected_z_depth);
-				}
+		trace_hit(scene, ray, hit, ray_depth, sampler, out_color, out_z_depth);
+	}
+}
 
-				// Update shading for the intersection point by weighting according to the reflected color
-				*out_color += material.k_reflection * reflected_color;
-			}
-		}
-		
-		// @@@@@@ VOTRE CODE ICI
-		// Déterminer la couleur associée à la réfraction d'un rayon de manière récursive.
-		if (!(abs(material.k_refraction) < EPSILON) && (ray_depth < MAX_DEPTH)) { // if refracted
-			double3 refracted_color{0, 0, 0};
-			double3 incident_direction = ray.direction;
-			double3 normal = hit.normal;
-			double3 transmitted_direction = incident_direction;
-			double3 reflected_direction = incident_direction - 2 * linalg::dot(incident_direction, normal) * normal;
-			double3 refracted_ray = transmitted_direction - reflected_direction;
-			
-			Ray refracted_lightRay = Ray(hit.position + EPSILON * hit.normal, refracted_ray);
-			double refracted_z_depth = scene.camera.z_far;
+namespace {
+	// Rayon en attente dans la pile de trace_hit.
+	struct PathEntry {
+		Ray ray;
+		int depth;
+		double throughput;
+		uint32_t key;
+	};
+}
 
-			if (ray_depth < scene.max_ray_depth) {
-				trace(scene, refracted_lightRay, ray_depth++, &refracted_color, &refracted_z_depth);
+void Raytracer::trace_hit(const Scene& scene,
+						  Ray ray, const Intersection& hit, int ray_depth, Sampler& sampler,
+						  double3* out_color, double* out_z_depth)
+{
+	// Parcours en profondeur d'abord : les enfants sont empilés à l'envers afin que le premier
+	// (la réflexion) soit traité en premier, comme le ferait la récursion.
+	PathEntry stack[TRACE_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = PathEntry{ray, ray_depth, 1.0, 1};
+
+	double3 color{0, 0, 0};
+	const Intersection* current = &hit;
+	Intersection secondary_hit;
+
+	while (stack_size > 0) {
+		PathEntry entry = stack[--stack_size];
+		if (current == nullptr) {
+			if (!scene.container->intersect(entry.ray, EPSILON, scene.camera.z_far, &secondary_hit)) {
+				continue;
 			}
+			current = &secondary_hit;
+		}
 
-			// Update shading for the intersection point by weighting according to the transmitted color
-			*out_color += material.k_refraction * refracted_color;
-		} 
 		// Assumez que l'extérieur/l'air a un indice de réfraction de 1.
 		//
 		// Toutes les géométries sont des surfaces et non pas de volumes.
-		*out_color = shade(scene, hit);
-		*out_z_depth = hit.depth;
-	} 
+		color += entry.throughput * shade(scene, *current, entry.depth, sampler);
+
+		SecondaryRay secondary[MAX_SECONDARY_RAYS];
+		int num_secondary = scatter(scene, entry.ray, *current, entry.depth, secondary);
+		for (int i = num_secondary - 1; i >= 0; i--) {
+			double throughput = entry.throughput * secondary[i].weight;
+			uint32_t key = (entry.key << 1) | static_cast<uint32_t>(i);
+			if (continue_path(scene, sampler, entry.depth + 1, key, &throughput)) {
+				stack[stack_size++] = PathEntry{secondary[i].ray, entry.depth + 1, throughput, key};
+			}
+		}
+		current = nullptr;
+	}
+
+	*out_color = color;
+	*out_z_depth = hit.depth;
+}
+
+bool Raytracer::continue_path(const Scene& scene, Sampler& sampler, int ray_depth, uint32_t key,
+							  double* throughput)
+{
+	if (*throughput < scene.min_throughput) {
+		STAT_ADD(STAT_PATHS_CUT_BY_THROUGHPUT, 1);
+		return false;
+	}
+
+	if (scene.russian_roulette && ray_depth >= scene.roulette_depth) {
+		double survival = std::min(1.0, std::max(ROULETTE_MIN_SURVIVAL, *throughput));
+		if (survival < 1.0) {
+			sampler.start_dimension(DIM_ROULETTE, ray_depth, key);
+			if (sampler.next_1d() >= survival) {
+				STAT_ADD(STAT_PATHS_CUT_BY_ROULETTE, 1);
+				return false;
+			}
+			*throughput /= survival;
+		}
+	}
+
+	STAT_ADD(STAT_SECONDARY_RAYS, 1);
+	return true;
+}
+
+int Raytracer::scatter(const Scene& scene, const Ray& ray, const Intersection& hit, int ray_depth,
+					   SecondaryRay* out)
+{
+	if (ray_depth >= scene.max_ray_depth || ray_depth >= MAX_DEPTH) {
+		return 0;
+	}
+
+	const Material& material = ResourceManager::Instance()->materials[hit.material];
+	int count = 0;
+
+	// @@@@@@ VOTRE CODE ICI
+	// Déterminer la couleur associée à la réflection d'un rayon de manière récursive.
+	if (!(abs(material.k_reflection) < EPSILON)) { // if reflected
+		double3 v_i = ray.origin - ray.direction; // inverse direction of the ray
+		double3 reflected_ray = 2 * linalg::dot(v_i, hit.normal) * hit.normal - v_i;
+
+		out[count++] = SecondaryRay{Ray(hit.position + EPSILON * hit.normal, reflected_ray), material.k_reflection};
+	}
+
+	// @@@@@@ VOTRE CODE ICI
+	// Déterminer la couleur associée à la réfraction d'un rayon de manière récursive.
+	if (!(abs(material.k_refraction) < EPSILON)) { // if refracted
+		double3 incident_direction = ray.direction;
+		double3 normal = hit.normal;
+		double3 transmitted_direction = incident_direction;
+		double3 reflected_direction = incident_direction - 2 * linalg::dot(incident_direction, normal) * normal;
+		double3 refracted_ray = transmitted_direction - reflected_direction;
+
+		out[count++] = SecondaryRay{Ray(hit.position + EPSILON * hit.normal, refracted_ray), material.k_refraction};
+	}
+	return count;
 }
 
 // @@@@@@ VOTRE CODE ICI
@@ -181,9 +408,130 @@ void Raytracer::trace(const Scene& scene,
 //        	- Si texture est présente, prende la couleur à la coordonnées uv
 //			- Si aucune texture, prendre la couleur associé au matériel.
 
-double3 Raytracer::shade(const Scene& scene, Intersection hit)
+double3 Raytracer::shade(const Scene& scene, Intersection hit, int ray_depth, Sampler& sampler)
 {
-	Material& material = ResourceManager::Instance()->materials[hit.key_material];
+	std::vector<double> occlusion(scene.lights.size());
+	for (size_t ilight = 0; ilight < scene.lights.size(); ilight++) {
+		int light_index = static_cast<int>(ilight);
+		int num_probes = shadow_probes(scene, light_index);
+		int num_traced = 0;
+		int num_occluded = 0;
+
+		// A few probe rays first: when they agree, the full set is skipped
+		if (num_probes > 0) {
+			num_occluded = trace_shadow_set(scene, hit, ray_depth, light_index, num_probes, sampler);
+			num_traced = num_probes;
+		}
+		if (num_probes == 0 || !shadow_probes_agree(num_occluded, num_probes)) {
+			int num_rays = shadow_samples(scene, light_index);
+			num_occluded += trace_shadow_set(scene, hit, ray_depth, light_index, num_rays, sampler);
+			num_traced += num_rays;
+		}
+
+		// Average the occlusion factor based on the number of rays
+		occlusion[ilight] = static_cast<double>(num_occluded) / num_traced;
+	}
+
+	return shade_occluded(scene, hit, occlusion.data());
+}
+
+int Raytracer::shadow_samples(const Scene& scene, int ilight)
+{
+	const SphericalLight& light = scene.lights[ilight];
+	if (light.radius <= 0) {
+		return 1; // A point light casts no penumbra
+	}
+	return light.shadow_samples > 0 ? light.shadow_samples : scene.shadow_samples;
+}
+
+int Raytracer::shadow_probes(const Scene& scene, int ilight)
+{
+	// Probing only pays off when the full set is larger than the probe set
+	return scene.shadow_probes < shadow_samples(scene, ilight) ? scene.shadow_probes : 0;
+}
+
+bool Raytracer::shadow_probes_agree(int num_occluded, int num_probes)
+{
+	if (num_occluded == 0) {
+		STAT_ADD(STAT_SHADOW_PROBES_LIT, 1);
+		return true;
+	}
+	if (num_occluded == num_probes) {
+		STAT_ADD(STAT_SHADOW_PROBES_OCCLUDED, 1);
+		return true;
+	}
+	STAT_ADD(STAT_SHADOW_PROBES_PENUMBRA, 1);
+	return false;
+}
+
+int Raytracer::trace_shadow_set(const Scene& scene, const Intersection& hit, int ray_depth, int ilight,
+								int set_size, Sampler& sampler)
+{
+	int num_occluded = 0;
+
+	// The shadow rays of a light share their origin: they are traced as packets.
+	for (int first = 0; first < set_size; first += PACKET_MAX_RAYS) {
+		RayPacket shadow_packet;
+		shadow_rays(scene, hit, ray_depth, ilight, first, set_size, sampler, &shadow_packet);
+
+		// Check if the sampled directions are occluded
+		bool occluded[PACKET_MAX_RAYS];
+		occluded_rays(scene, shadow_packet, occluded);
+		num_occluded += count_occluded(shadow_packet, occluded);
+	}
+	return num_occluded;
+}
+
+void Raytracer::shadow_rays(const Scene& scene, const Intersection& hit, int ray_depth, int ilight,
+							int first_sample, int set_size, Sampler& sampler, RayPacket* packet)
+{
+	const SphericalLight& light = scene.lights[ilight];
+	double3 origin = hit.position + EPSILON * hit.normal;
+
+	// One random shift per light: every packet (and the probe set) of the light shares it
+	sampler.start_dimension(DIM_SHADOW, ray_depth, static_cast<uint32_t>(ilight));
+	double2 shift = sampler.next_2d();
+
+	// Light disk facing the intersection point
+	double3 light_direction = linalg::normalize(light.position - origin);
+	double3 helper = std::abs(light_direction.x) > 0.9 ? double3{0, 1, 0} : double3{1, 0, 0};
+	double3 tangent = linalg::normalize(linalg::cross(helper, light_direction));
+	double3 bitangent = linalg::cross(light_direction, tangent);
+
+	packet->count = std::min(PACKET_MAX_RAYS, set_size - first_sample);
+	packet->t_min = EPSILON;
+	STAT_ADD(STAT_SHADOW_RAYS, packet->count);
+
+	for (int i = 0; i < packet->count; i++) {
+		// Stratified point on the light disk
+		double3 target = light.position;
+		if (light.radius > 0) {
+			double2 disk = square_to_unit_disk(hammersley_2d(first_sample + i, set_size, shift));
+			target += light.radius * (disk.x * tangent + disk.y * bitangent);
+		}
+
+		// Do not consider objects behind the light
+		double3 to_light = target - origin;
+		double distance = linalg::length(to_light);
+		packet->rays[i] = Ray(origin, to_light / distance);
+		packet->t_max[i] = distance - EPSILON;
+	}
+}
+
+int Raytracer::count_occluded(const RayPacket& packet, const bool* occluded)
+{
+	int num_occluded = 0;
+	for (int i = 0; i < packet.count; i++) {
+		if (occluded[i]) {
+			num_occluded++;
+		}
+	}
+	return num_occluded;
+}
+
+double3 Raytracer::shade_occluded(const Scene& scene, const Intersection& hit, const double* occlusion)
+{
+	const Material& material = ResourceManager::Instance()->materials[hit.material];
 	double3 color;
 
 	if (material.texture_albedo.width() > 0 && material.texture_albedo.height() > 0) {
@@ -210,14 +558,9 @@ double3 Raytracer::shade(const Scene& scene, Intersection hit)
 	double3 diffuse{0, 0, 0};
 	double3 specular{0, 0, 0};
 
-	// Ambient contribution
-	double3 ambient = scene.ambient_light * material.k_ambient;
+	for (size_t ilight = 0; ilight < scene.lights.size(); ilight++) {
+		const SphericalLight& light = scene.lights[ilight];
 
-	// Diffuse and specular contributions
-	double3 diffuse{0, 0, 0};
-	double3 specular{0, 0, 0};
-
-	for (const auto& light : scene.lights) {
 		// Calculate the direction from the intersection point to the light
 		double3 light_direction = linalg::normalize(light.position - hit.position);
 
@@ -225,39 +568,16 @@ double3 Raytracer::shade(const Scene& scene, Intersection hit)
 		double3 view_direction = linalg::normalize(scene.camera.position - hit.position);
 		double3 halfway_direction = linalg::normalize(light_direction + view_direction);
 
+		// Only the visible fraction of this light contributes (not the lights already summed)
+		double visibility = 1.0 - occlusion[ilight];
+
 		// Calculate the diffuse component
 		double diffuse_intensity = std::max(0.0, linalg::dot(hit.normal, light_direction));
-		diffuse += light.emission * material.k_diffuse * diffuse_intensity;
+		diffuse += visibility * light.emission * material.k_diffuse * diffuse_intensity;
 
 		// Calculate the specular component using the Blinn specular model
 		double specular_intensity = std::pow(std::max(0.0, linalg::dot(hit.normal, halfway_direction)), material.shininess);
-		specular += light.emission * material.k_specular * specular_intensity;
-
-		// Calculate the occlusion factor for penumbra
-		double occlusion_factor = 0.0;
-		int num_rays = 16; // Number of rays to sample
-
-		for (int i = 0; i < num_rays; i++) {
-			// Sample a random direction inside the cone between the intersection point and the light
-			double2 random_direction_2d = random_in_unit_disk();
-			double3 random_direction{ random_direction_2d.x, random_direction_2d.y, 0.0 };
-			random_direction *= light.radius;
-			double3 sampled_direction = linalg::normalize(light_direction + random_direction);
-
-			// Check if the sampled direction is occluded
-			Ray shadow_ray(hit.position + EPSILON * hit.normal, sampled_direction);
-			Intersection shadow_hit;
-
-			if (scene.container->intersect(shadow_ray, EPSILON, scene.camera.z_far, &shadow_hit)) {
-				occlusion_factor += 1.0; // Increment occlusion factor if the ray is occluded
-			}
-		}
-
-		occlusion_factor /= num_rays; // Average the occlusion factor based on the number of rays
-
-		// Apply the occlusion factor to the diffuse and specular contributions
-		diffuse *= (1.0 - occlusion_factor);
-		specular *= (1.0 - occlusion_factor);
+		specular += visibility * light.emission * material.k_specular * specular_intensity;
 	}
 
 	// Combine the ambient, diffuse, and specular contributions
@@ -8,44 +8,200 @@
 #include <iostream>
 #include <cmath>
 #include <cfloat>
+#include <algorithm>
 
 #include "scene.h"
 #include "frame.h"
 #include "resource_manager.h"
+#include "sampler.h"
+#include "thread_pool.h"
 #include "linalg/linalg.h"
 using namespace linalg::aliases;
 #define MAX_DEPTH 10
+#define TILE_SIZE 16
+// Côté des blocs de pixels dont les rayons primaires sont tracés en paquet (PACKET_WIDTH² <= PACKET_MAX_RAYS).
+#define PACKET_WIDTH 4
+
+// Nombre maximal de rayons secondaires (réflexion, réfraction) engendrés par une intersection.
+#define MAX_SECONDARY_RAYS 2
+// Taille de la pile de trace_hit : au plus un frère en attente par niveau, plus le rayon courant.
+#define TRACE_STACK_SIZE (MAX_DEPTH * (MAX_SECONDARY_RAYS - 1) + 1)
+// Probabilité de survie minimale de la roulette russe ; borne le facteur appliqué aux survivants.
+#define ROULETTE_MIN_SURVIVAL 0.05
+
+// Repère de la caméra pré-calculé une seule fois pour générer les rayons primaires.
+struct CameraBasis {
+    double3 right;
+    double3 up;
+    // Centre du pixel (0,0) sur le plan de projection.
+    double3 bottom_left;
+    double pixel_width;
+    double pixel_height;
+};
+
+// Une tuile de l'image couvrant les pixels [x0,x1) x [y0,y1).
+struct Tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Échantillonnage adaptatif : niveau de confiance (loi normale, 95%) de l'intervalle sur la moyenne.
+#define ADAPTIVE_CONFIDENCE_Z 1.96
+// Luminance minimale utilisée pour l'erreur relative ; évite de suréchantillonner les pixels sombres.
+#define ADAPTIVE_MIN_LUMINANCE 0.01
+
+// Moyenne et variance incrémentales (Welford) de la luminance des échantillons d'un pixel.
+struct PixelVariance {
+    int count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double value) {
+        count++;
+        double delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    // Vrai lorsque la demi-largeur de l'intervalle de confiance sur la moyenne est inférieure
+    // à threshold, relativement à la luminance moyenne.
+    bool converged(double threshold) const {
+        if (count < 2) {
+            return false;
+        }
+        double standard_error = std::sqrt(m2 / (count - 1) / count);
+        return ADAPTIVE_CONFIDENCE_Z * standard_error <= threshold * std::max(mean, ADAPTIVE_MIN_LUMINANCE);
+    }
+};
+
+// Accumulation des échantillons d'un pixel pendant le rendu d'un bloc.
+struct PixelAccumulator {
+    double3 color{0, 0, 0};
+    double z_depth = 0;
+    int nsamples = 0;
+    PixelVariance variance;
+    // Vrai lorsque le pixel a convergé (échantillonnage adaptatif).
+    bool done = false;
+};
+
+// Rayon secondaire engendré à une intersection, et son poids dans la couleur de celle-ci.
+struct SecondaryRay {
+    Ray ray;
+    double weight;
+};
+
+// État propre à chaque fil de rendu. Aligné sur une ligne de cache pour éviter le faux partage.
+struct alignas(64) RenderThreadState {
+    long long tiles = 0;
+    long long primary_rays = 0;
+};
 
 class Raytracer 
 {
 public:
     // Rend la scène donnée par lancer de rayon.
     // Met à jour la frame avec la couleur et la profondeur trouvée.
+    // L'image est découpée en tuiles rendues en parallèle sur scene.num_threads fils.
     static void render(const Scene& scene, Frame *output);
 
 private:
+    // Rend tous les pixels d'une tuile. Appelée par un seul fil à la fois pour une tuile donnée.
+    static void render_tile(const Scene& scene, const CameraBasis& basis, const Tile& tile,
+                            Frame* output, double* z_buffer, RenderThreadState* state);
+
+    // Rend l'image avec l'intégrateur en vagues (wavefront.cpp) : les rayons de tous les pixels
+    // passent ensemble par chaque étape (génération, intersection, ombres, ombrage, rayons secondaires).
+    // Le résultat est identique, au bit près, à celui de render_tile.
+    static void render_wavefront(const Scene& scene, const CameraBasis& basis, ThreadPool& pool,
+                                 Frame* output, double* z_buffer, std::vector<RenderThreadState>& states);
+
+    // Rayon primaire passant par le pixel (x, y), décalé aléatoirement selon jitter_radius.
+    static Ray camera_ray(const Scene& scene, const CameraBasis& basis, int x, int y, Sampler& sampler);
+
+    // Intersections les plus proches des rayons d'un paquet (par paquet ou rayon par rayon selon la scène).
+    static void intersect_rays(const Scene& scene, const RayPacket& packet, Intersection* hits, bool* hit_found);
+
+    // Occlusion des rayons d'un paquet (par paquet ou rayon par rayon selon la scène).
+    static void occluded_rays(const Scene& scene, const RayPacket& packet, bool* occluded);
+
+    // Ajoute un échantillon à un pixel et met à jour son critère d'arrêt adaptatif.
+    static void add_sample(const Scene& scene, PixelAccumulator* pixel, double3 color, double z_depth);
+
+    // Écrit la moyenne des échantillons d'un pixel dans l'image, après le test de profondeur.
+    static void resolve_pixel(const Scene& scene, int x, int y, const PixelAccumulator& pixel,
+                              Frame* output, double* z_buffer);
+
     // Lance un rayon dans la scène tout en étant responsable de la détection d'intersection.
-    // Permet des appels récursifs pour compléter la réflection et la réfraction.
+    // La réflection et la réfraction sont complétées par trace_hit.
     // 
     // Paramètres
     //   scene: Scène dans laquelle le rayon est lancé
     //   rayon: Rayon actuel dans la scène
     //   ray_depth: Profondeur de récursion du rayon actuellement lancé
+    //   sampler: Générateur aléatoire propre au pixel et à l'échantillon courant
     //   out_color: Couleur associée à l'intersection
     //   out_z_depth: Profondeur de la plus proche intersection qui agit comme une borne supérieure
 
     static void trace(const Scene& scene, 
-                      Ray ray, int ray_depth, 
+                      Ray ray, int ray_depth, Sampler& sampler,
                       double3 *out_color, double *out_z_depth);
 
+    // Suite de trace() une fois l'intersection la plus proche connue : ombrage, réflexion et réfraction.
+    // Permet de séparer la recherche d'intersection (ex. par paquets) du reste du calcul.
+    // Les rayons secondaires sont suivis itérativement avec une pile bornée (TRACE_STACK_SIZE) ;
+    // chaque intersection contribue son ombrage pondéré par la contribution du chemin (throughput).
+    static void trace_hit(const Scene& scene,
+                          Ray ray, const Intersection& hit, int ray_depth, Sampler& sampler,
+                          double3 *out_color, double *out_z_depth);
+
+    // Rayons de réflexion et de réfraction à lancer depuis une intersection, avec leur poids.
+    // Aucun rayon n'est engendré au-delà de la profondeur maximale.
+    // Renvoie le nombre de rayons écrits dans out (au plus MAX_SECONDARY_RAYS).
+    static int scatter(const Scene& scene, const Ray& ray, const Intersection& hit, int ray_depth,
+                       SecondaryRay* out);
+
+    // Décide si un rayon secondaire de profondeur ray_depth est lancé (min_throughput, roulette russe)
+    // et met à jour sa contribution. key identifie le rayon dans l'arbre de l'échantillon ; avec la
+    // profondeur, elle détermine le flux aléatoire de la roulette.
+    static bool continue_path(const Scene& scene, Sampler& sampler, int ray_depth, uint32_t key,
+                              double* throughput);
+
     // Calcule l'ombrage (le shading) à l'intersection avec la géométrie.
     // Responsable de l'illumination locale ainsi que de la génération des ombres dans la scène.
     // 
     // Paramètres
     //   scene: Scène dans laquelle le rayon est lancé
     //   hit: Information sur l'intersection
+    //   ray_depth: Profondeur du rayon ayant produit l'intersection
+    //   sampler: Générateur aléatoire propre au pixel et à l'échantillon courant
     //
     // Renvoie la couleur calculée au point d'intersection.
 	static double3 shade(const Scene& scene,
-                        Intersection hit);
+                        Intersection hit, int ray_depth, Sampler& sampler);
+
+    // Nombre de rayons d'ombre d'une lumière : 1 pour une lumière ponctuelle, sinon celui de la
+    // lumière ou, à défaut, celui de la scène.
+    static int shadow_samples(const Scene& scene, int ilight);
+
+    // Nombre de sondes à lancer avant l'ensemble complet pour une lumière (0 : pas de sondes).
+    static int shadow_probes(const Scene& scene, int ilight);
+
+    // Vrai si les sondes d'une lumière s'accordent (chemin rapide) ; met à jour les compteurs.
+    static bool shadow_probes_agree(int num_occluded, int num_probes);
+
+    // Rayons d'ombre [first_sample, first_sample + PACKET_MAX_RAYS) d'un ensemble de set_size points
+    // vers une lumière (première moitié de shade). Les points visés sont stratifiés sur le disque de
+    // la lumière, orienté face à l'intersection ; chaque rayon s'arrête à la lumière.
+    static void shadow_rays(const Scene& scene, const Intersection& hit, int ray_depth, int ilight,
+                            int first_sample, int set_size, Sampler& sampler, RayPacket* packet);
+
+    // Lance un ensemble complet de set_size rayons d'ombre et renvoie le nombre de rayons occludés.
+    static int trace_shadow_set(const Scene& scene, const Intersection& hit, int ray_depth, int ilight,
+                                int set_size, Sampler& sampler);
+
+    // Nombre de rayons d'ombre d'un paquet qui sont occludés.
+    static int count_occluded(const RayPacket& packet, const bool* occluded);
+
+    // Illumination locale connaissant la fraction d'occlusion de chaque lumière (seconde moitié de shade).
+    static double3 shade_occluded(const Scene& scene, const Intersection& hit, const double* occlusion);
 };
\ No newline at end of file
@@ -2,10 +2,12 @@
 
 ResourceManager *ResourceManager::Instance_ = NULL;
 
-ResourceManager::ResourceManager(){};
+ResourceManager::ResourceManager() : mesh_split_method(SPLIT_SAH) {};
 
 ResourceManager::~ResourceManager() {
   materials.clear();
+  material_handles.clear();
+  meshes.clear();
 };
 
 ResourceManager* ResourceManager::Instance() {
@@ -16,6 +18,44 @@ ResourceManager* ResourceManager::Instance() {
   return Instance_;
 }
 
+MaterialHandle ResourceManager::add_material(const std::string& name, const Material& material) {
+  auto it = material_handles.find(name);
+  if (it != material_handles.end()) {
+    materials[it->second] = material;
+    return it->second;
+  }
+
+  MaterialHandle handle = static_cast<MaterialHandle>(materials.size());
+  materials.push_back(material);
+  material_handles[name] = handle;
+  return handle;
+}
+
+bool ResourceManager::find_material(const std::string& name, MaterialHandle* handle) const {
+  auto it = material_handles.find(name);
+  if (it == material_handles.end()) {
+    return false;
+  }
+  *handle = it->second;
+  return true;
+}
+
+std::shared_ptr<const MeshData> ResourceManager::load_mesh(const std::string& filename) {
+  auto it = meshes.find(filename);
+  if (it != meshes.end()) {
+    return it->second;
+  }
+
+  std::ifstream file(filename.c_str());
+  if (!file.good()) {
+    throw std::string("Unable to open OBJ file: ") + filename;
+  }
+
+  std::shared_ptr<MeshData> data = std::make_shared<MeshData>(file, mesh_split_method, bvh_cache_dir);
+  meshes[filename] = data;
+  return data;
+}
+
 void ResourceManager::Release() {
   delete Instance_;
   Instance_ = nullptr;
@@ -10,8 +10,33 @@ class ResourceManager {
   // Relâche l'instance
   static void Release();
 
-  // Tous les différents matériaux sont conversés ici question de performance
-  std::map<std::string, Material> materials;
+  // Tous les différents matériaux sont conversés ici question de performance.
+  // Table dense indexée par MaterialHandle : l'accès lors de l'ombrage est une simple lecture.
+  std::vector<Material> materials;
+
+  // Handle de chaque matériau, par nom (utilisé uniquement à l'analyse de la scène).
+  std::map<std::string, MaterialHandle> material_handles;
+
+  // Ajoute un matériau, ou remplace celui du même nom en conservant son handle.
+  MaterialHandle add_material(const std::string& name, const Material& material);
+
+  // Cherche le handle d'un matériau par nom ; retourne false s'il n'existe pas.
+  bool find_material(const std::string& name, MaterialHandle* handle) const;
+
+  // Géométrie des maillages, indexée par nom de fichier OBJ. Chaque fichier n'est lu qu'une fois ;
+  // toutes les instances Mesh qui le référencent partagent les mêmes données. Leur BVH local est
+  // construit à la fin de l'analyse de la scène (voir MeshData::build).
+  std::map<std::string, std::shared_ptr<MeshData>> meshes;
+
+  // Méthode de construction du BVH local des maillages chargés par la suite (SPLIT_SAH par défaut).
+  BVHSplitMethod mesh_split_method;
+
+  // Dossier du cache disque des BVH (voir build_bvh_cached) ; vide (par défaut) pour le désactiver.
+  std::string bvh_cache_dir;
+
+  // Retourne la géométrie du fichier OBJ donné, en la chargeant au premier appel.
+  // Lance une std::string si le fichier ne peut être ouvert.
+  std::shared_ptr<const MeshData> load_mesh(const std::string& filename);
 private:
   static ResourceManager* Instance_;
  
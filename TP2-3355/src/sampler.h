@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "pcg32/pcg32.h"
+#include "basic.h"
+
+// Les différentes dimensions logiques consommant des nombres aléatoires.
+// Chaque dimension possède son propre flux, de sorte que la quantité de nombres tirés
+// par l'une n'influence jamais les valeurs vues par une autre.
+enum SampleDimension : uint32_t {
+    DIM_PIXEL_JITTER = 0,
+    DIM_SHADOW = 1,
+    DIM_ROULETTE = 2,
+};
+
+// Point i de l'ensemble de Hammersley à n points dans [0,1)^2, décalé modulo 1 par shift
+// (rotation de Cranley-Patterson). Les n points sont stratifiés selon x et bien répartis selon y ;
+// un décalage aléatoire par ensemble garde l'estimateur sans biais.
+inline double2 hammersley_2d(uint32_t i, uint32_t n, double2 shift) {
+    // Inverse radical en base 2 : miroir des bits de i.
+    uint32_t bits = i;
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+    bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+
+    double x = (i + 0.5) / n + shift.x;
+    double y = bits * (1.0 / 4294967296.0) + shift.y;
+    return double2{x - std::floor(x), y - std::floor(y)};
+}
+
+// Générateur de nombres aléatoires déterministe par pixel et par échantillon.
+//
+// Le flux est entièrement déterminé par (graine de la scène, pixel, échantillon, dimension) :
+// le rendu est donc identique au bit près peu importe le nombre de fils et l'ordre des tuiles.
+// Un Sampler vit sur la pile du fil de rendu ; aucun état n'est partagé.
+class Sampler {
+public:
+    Sampler() : Sampler(0, 0, 0) {}
+
+    Sampler(uint64_t seed, int pixel_index, int sample_index)
+        : pixel_key(mix(seed ^ mix(static_cast<uint64_t>(pixel_index)))),
+          sample_index(static_cast<uint64_t>(sample_index))
+    {
+        start_dimension(DIM_PIXEL_JITTER);
+    }
+
+    // Positionne le générateur au début du flux associé à une dimension.
+    // kind: SampleDimension, bounce: profondeur du rayon, index: indice libre (ex. lumière).
+    void start_dimension(uint32_t kind, uint32_t bounce = 0, uint32_t index = 0) {
+        uint64_t dimension = (uint64_t(kind) << 48) | (uint64_t(bounce) << 32) | uint64_t(index);
+        rng.seed(mix(pixel_key ^ mix(dimension)), sample_index);
+    }
+
+    // Valeur uniforme dans [0,1).
+    double next_1d() { return rng.nextDouble(); }
+
+    // Vecteur uniforme dans [0,1)^2.
+    double2 next_2d() {
+        double u = rng.nextDouble();
+        double v = rng.nextDouble();
+        return double2{u, v};
+    }
+
+private:
+    pcg32 rng;
+    uint64_t pixel_key;
+    uint64_t sample_index;
+
+    // Mélangeur de bits SplitMix64 ; décorrèle les graines voisines.
+    static uint64_t mix(uint64_t z) {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
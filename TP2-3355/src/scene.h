@@ -8,10 +8,12 @@
 #include <iostream>
 #include <cmath>
 #include <cfloat>
+#include <cstdint>
 
 #include "resource_manager.h"
 #include "object.h"
 #include "container.h"
+#include "animation.h"
 #include "linalg/linalg.h"
 using namespace linalg::aliases;
 
@@ -49,6 +51,7 @@ public:
         SET_VEC3(emission)
 #define SET_FLOAT(_name) _name = params[#_name].size() == 1 ? params[#_name][0] : 0;
         SET_FLOAT(radius)
+        shadow_samples = params["shadow_samples"].size() == 1 ? static_cast<int>(params["shadow_samples"][0]) : 0;
     }
 
     // Position de la lumière.
@@ -59,6 +62,19 @@ public:
 
     // Taille Sphérique de la source de lumière
     double radius;
+
+    // Nombre de rayons d'ombre par intersection ; 0 -> valeur de la scène (Scene::shadow_samples).
+    // Ignoré pour une lumière ponctuelle, qui n'utilise qu'un seul rayon.
+    int shadow_samples;
+};
+
+
+// Manière dont les rayons d'un échantillon sont tracés.
+enum IntegratorType {
+    // Chaque échantillon est tracé récursivement (trace -> shade -> trace), tuile par tuile.
+    INTEGRATOR_RECURSIVE,
+    // Les rayons de tous les pixels sont regroupés en files traitées étape par étape.
+    INTEGRATOR_WAVEFRONT,
 };
 
 
@@ -76,18 +92,69 @@ public:
     // Région de variation lors du sampling aléatoirement
     double jitter_radius;
 
+    // Échantillonnage adaptatif : chaque pixel reçoit entre adaptive_min_samples et adaptive_max_samples
+    // rayons, et s'arrête dès que l'erreur relative estimée sur sa luminance passe sous adaptive_threshold.
+    // Remplace samples_per_pixel lorsqu'il est actif.
+    bool adaptive_sampling;
+    int adaptive_min_samples;
+    int adaptive_max_samples;
+    double adaptive_threshold;
+
     //Le nombre maximal de récursion possible.
     int max_ray_depth;
 
+    // Un rayon secondaire dont la contribution (produit des coefficients de réflexion et
+    // de réfraction le long du chemin) est inférieure à min_throughput n'est pas lancé.
+    double min_throughput;
+
+    // Roulette russe : à partir de la profondeur roulette_depth, un rayon secondaire survit avec une
+    // probabilité égale à sa contribution (bornée) et celle-ci est divisée d'autant (estimateur sans biais).
+    bool russian_roulette;
+    int roulette_depth;
+
+    // Graine des générateurs aléatoires ; le rendu est reproductible pour une même graine.
+    uint64_t seed;
+
+    // Nombre de fils utilisés pour le rendu (0 -> tous les coeurs).
+    int num_threads;
+
+    // Trace les rayons primaires (blocs de 4x4 pixels) et les rayons d'ombre d'une lumière par paquets.
+    bool ray_packets;
+
+    // Intégrateur utilisé pour le rendu ; les deux produisent la même image.
+    IntegratorType integrator;
+
+    // Noyaux SIMD demandés pour l'intersection des maillages (résolus au début du rendu).
+    SimdLevel simd;
+
     // La caméra utilisée durant le rendu de la scène.
     Camera camera;
 
+    // Nombre de rayons d'ombre par lumière étendue, sauf si la lumière en précise un autre.
+    int shadow_samples;
+
+    // Ombres adaptatives : shadow_probes rayons sont d'abord lancés vers une lumière étendue ;
+    // s'ils s'accordent (tous libres ou tous occludés), le point est considéré entièrement éclairé
+    // ou dans l'ombre, sinon l'ensemble complet de rayons est ajouté. 0 désactive le mode.
+    int shadow_probes;
+
     // Vecteur correspondant à la lumière ambiante de la scène
     double3 ambient_light;
 
     // Liste des lumières sphériques.
     std::vector<SphericalLight> lights;
 
+    // Nombre d'images de la séquence (1 : image fixe). Les images sont numérotées à partir de 0,
+    // dans les mêmes unités que les images clés des transformations animées.
+    int num_frames;
+
+    // Entre deux images, le BVH est réajusté (refit) sur les nouvelles boîtes ; il est reconstruit
+    // lorsque son coût SAH dépasse rebuild_threshold fois celui de sa dernière construction (0 : toujours).
+    double rebuild_threshold;
+
+    // Objets dont la transformation varie d'une image à l'autre.
+    std::vector<ObjectAnimation> animations;
+
     // Liste des pointeurs vers les objets de la scène.
     // Notez que la classe Object est abstraite, donc les items pointeront réellement
     // vers des objets Spheres, Planes, Mehses, etc.
@@ -98,5 +165,21 @@ public:
         resolution[0] = resolution[1] = 640;
         samples_per_pixel = 1;
         max_ray_depth = 0;
+        shadow_samples = 16;
+        shadow_probes = 0;
+        min_throughput = 1e-3;
+        russian_roulette = false;
+        roulette_depth = 0;
+        num_threads = 0;
+        seed = 0;
+        simd = SIMD_AUTO;
+        ray_packets = true;
+        integrator = INTEGRATOR_RECURSIVE;
+        jitter_radius = 0;
+        adaptive_sampling = false;
+        adaptive_min_samples = adaptive_max_samples = 1;
+        adaptive_threshold = 0;
+        num_frames = 1;
+        rebuild_threshold = 1.5;
     }
 };
\ No newline at end of file
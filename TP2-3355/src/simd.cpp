@@ -0,0 +1,355 @@
+#include "simd.h"
+
+#include <cfloat>
+#include <algorithm>
+#include <cmath>
+
+#if RAY_HAS_AVX2_KERNELS
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace {
+    SimdLevel active_level = SIMD_SCALAR;
+}
+
+bool Simd::avx2_supported() {
+#if RAY_HAS_AVX2_KERNELS && defined(_MSC_VER)
+    // CPUID.7.EBX[5] = AVX2, et le système doit sauvegarder les registres YMM (XCR0[2:1]).
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif RAY_HAS_AVX2_KERNELS
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+SimdLevel Simd::resolve(SimdLevel requested) {
+    if (requested == SIMD_AUTO) {
+        return avx2_supported() ? SIMD_AVX2 : SIMD_SCALAR;
+    }
+    if (requested == SIMD_AVX2 && !avx2_supported()) {
+        return SIMD_SCALAR;
+    }
+    return requested;
+}
+
+SimdLevel Simd::set_active(SimdLevel requested) {
+    active_level = resolve(requested);
+    return active_level;
+}
+
+SimdLevel Simd::active() {
+    return active_level;
+}
+
+const char* Simd::name(SimdLevel level) {
+    switch (level) {
+        case SIMD_AUTO: return "auto";
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+bool Simd::parse(const std::string& name, SimdLevel* level) {
+    for (SimdLevel candidate : {SIMD_AUTO, SIMD_SCALAR, SIMD_AVX2}) {
+        if (name == Simd::name(candidate)) {
+            *level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+#if RAY_HAS_AVX2_KERNELS
+
+// Borne relative de l'erreur d'arrondi accumulée par le test en float (32 ulp).
+// Chaque quantité X est accompagnée d'une borne B_X = gamma * (même calcul en valeurs absolues) ;
+// une voie n'est rejetée que si le test échoue même en tenant compte de cette borne.
+#define PACK_ERROR_GAMMA (32.0f * FLT_EPSILON * 0.5f)
+
+namespace {
+    RAY_TARGET_AVX2
+    inline __m256 abs_ps(__m256 x) {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+    }
+
+    RAY_TARGET_AVX2
+    inline __m256 dot_ps(const __m256 a[3], const __m256 b[3]) {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[0], b[0]), _mm256_mul_ps(a[1], b[1])),
+                             _mm256_mul_ps(a[2], b[2]));
+    }
+
+    RAY_TARGET_AVX2
+    inline void cross_ps(const __m256 a[3], const __m256 b[3], __m256 out[3]) {
+        out[0] = _mm256_sub_ps(_mm256_mul_ps(a[1], b[2]), _mm256_mul_ps(a[2], b[1]));
+        out[1] = _mm256_sub_ps(_mm256_mul_ps(a[2], b[0]), _mm256_mul_ps(a[0], b[2]));
+        out[2] = _mm256_sub_ps(_mm256_mul_ps(a[0], b[1]), _mm256_mul_ps(a[1], b[0]));
+    }
+
+    // Produit vectoriel de vecteurs positifs où les différences deviennent des sommes :
+    // majore l'amplitude des termes du vrai produit vectoriel (sert aux bornes d'erreur).
+    RAY_TARGET_AVX2
+    inline void cross_abs_ps(const __m256 a[3], const __m256 b[3], __m256 out[3]) {
+        out[0] = _mm256_add_ps(_mm256_mul_ps(a[1], b[2]), _mm256_mul_ps(a[2], b[1]));
+        out[1] = _mm256_add_ps(_mm256_mul_ps(a[2], b[0]), _mm256_mul_ps(a[0], b[2]));
+        out[2] = _mm256_add_ps(_mm256_mul_ps(a[0], b[1]), _mm256_mul_ps(a[1], b[0]));
+    }
+
+    // Conversion en float arrondie vers le bas (down) ou vers le haut, bornée à ±FLT_MAX.
+    float round_to_float(double x, bool down) {
+        x = std::min(std::max(x, -static_cast<double>(FLT_MAX)), static_cast<double>(FLT_MAX));
+        float f = static_cast<float>(x);
+        if (down && f > x) f = std::nextafter(f, -FLT_MAX);
+        if (!down && f < x) f = std::nextafter(f, FLT_MAX);
+        return f;
+    }
+}
+
+RAY_TARGET_AVX2
+uint32_t intersect_pack8_avx2(const TrianglePack8& pack, const Ray& ray, double t_min, double t_max) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 gamma = _mm256_set1_ps(PACK_ERROR_GAMMA);
+
+    // Origine du rayon relative au point de référence du paquet, calculée en double.
+    double3 o = ray.origin - pack.origin;
+    __m256 o_v[3], d_v[3];
+    for (int k = 0; k < 3; k++) {
+        o_v[k] = _mm256_set1_ps(static_cast<float>(o[k]));
+        d_v[k] = _mm256_set1_ps(static_cast<float>(ray.direction[k]));
+    }
+
+    __m256 p0[3], e1[3], e2[3];
+    for (int k = 0; k < 3; k++) {
+        p0[k] = _mm256_load_ps(pack.p0[k]);
+        e1[k] = _mm256_load_ps(pack.edge1[k]);
+        e2[k] = _mm256_load_ps(pack.edge2[k]);
+    }
+
+    __m256 abs_d[3], abs_e1[3], abs_e2[3], s[3], abs_s[3];
+    for (int k = 0; k < 3; k++) {
+        abs_d[k] = abs_ps(d_v[k]);
+        abs_e1[k] = abs_ps(e1[k]);
+        abs_e2[k] = abs_ps(e2[k]);
+        s[k] = _mm256_sub_ps(o_v[k], p0[k]);
+        // Majorant de |s| qui couvre aussi l'arrondi de o et de p0 en float.
+        abs_s[k] = _mm256_add_ps(abs_ps(o_v[k]), abs_ps(p0[k]));
+    }
+
+    // Möller-Trumbore, sans division : u = U/det, v = V/det, t = T/det.
+    __m256 h[3], h_abs[3], q[3], q_abs[3];
+    cross_ps(d_v, e2, h);
+    cross_abs_ps(abs_d, abs_e2, h_abs);
+    cross_ps(s, e1, q);
+    cross_abs_ps(abs_s, abs_e1, q_abs);
+
+    __m256 det = dot_ps(e1, h);
+    __m256 U = dot_ps(s, h);
+    __m256 V = dot_ps(d_v, q);
+    __m256 T = dot_ps(e2, q);
+
+    __m256 b_det = _mm256_mul_ps(gamma, dot_ps(abs_e1, h_abs));
+    __m256 b_u = _mm256_mul_ps(gamma, dot_ps(abs_s, h_abs));
+    __m256 b_v = _mm256_mul_ps(gamma, dot_ps(abs_d, q_abs));
+    __m256 b_t = _mm256_mul_ps(gamma, dot_ps(abs_e2, q_abs));
+
+    // Ramène le déterminant au positif pour comparer sans division.
+    __m256 det_sign = _mm256_and_ps(det, sign_mask);
+    __m256 D = _mm256_xor_ps(det, det_sign);
+    U = _mm256_xor_ps(U, det_sign);
+    V = _mm256_xor_ps(V, det_sign);
+    T = _mm256_xor_ps(T, det_sign);
+
+    // Le test exact rejette |det| < EPSILON.
+    __m256 det_ok = _mm256_cmp_ps(_mm256_add_ps(D, b_det), _mm256_set1_ps(static_cast<float>(EPSILON)), _CMP_GE_OQ);
+    // Le signe du déterminant est incertain : la voie est laissée au test exact.
+    __m256 ambiguous = _mm256_cmp_ps(D, b_det, _CMP_LE_OQ);
+
+    __m256 u_ok = _mm256_cmp_ps(U, _mm256_xor_ps(b_u, sign_mask), _CMP_GE_OQ);
+    __m256 v_ok = _mm256_cmp_ps(V, _mm256_xor_ps(b_v, sign_mask), _CMP_GE_OQ);
+    __m256 uv_ok = _mm256_cmp_ps(_mm256_add_ps(U, V),
+                                 _mm256_add_ps(_mm256_add_ps(D, b_det), _mm256_add_ps(b_u, b_v)), _CMP_LE_OQ);
+
+    // t dans [t_min, t_max] : T >= t_min * D et T <= t_max * D, à l'erreur près.
+    __m256 t_lo_v = _mm256_set1_ps(round_to_float(t_min, true));
+    __m256 t_hi_v = _mm256_set1_ps(round_to_float(t_max, false));
+    // Le produit par un t_min négatif est minimal avec D + b_det.
+    __m256 t_lo_bound = _mm256_sub_ps(_mm256_min_ps(_mm256_mul_ps(t_lo_v, _mm256_sub_ps(D, b_det)),
+                                                    _mm256_mul_ps(t_lo_v, _mm256_add_ps(D, b_det))), b_t);
+    __m256 t_hi_bound = _mm256_add_ps(_mm256_max_ps(_mm256_mul_ps(t_hi_v, _mm256_add_ps(D, b_det)),
+                                                    _mm256_mul_ps(t_hi_v, _mm256_sub_ps(D, b_det))), b_t);
+    __m256 t_ok = _mm256_and_ps(_mm256_cmp_ps(T, t_lo_bound, _CMP_GE_OQ), _mm256_cmp_ps(T, t_hi_bound, _CMP_LE_OQ));
+
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(u_ok, v_ok), _mm256_and_ps(uv_ok, t_ok));
+    __m256 candidates = _mm256_and_ps(det_ok, _mm256_or_ps(ambiguous, inside));
+
+    return static_cast<uint32_t>(_mm256_movemask_ps(candidates));
+}
+
+namespace {
+    RAY_TARGET_AVX2
+    inline __m256d neg_pd(__m256d x) {
+        return _mm256_xor_pd(x, _mm256_set1_pd(-0.0));
+    }
+
+    // ((0 + a0*b0) + a1*b1) + a2*b2, dans le même ordre que linalg::dot.
+    RAY_TARGET_AVX2
+    inline __m256d dot_pd(const __m256d a[3], const __m256d b[3]) {
+        __m256d sum = _mm256_add_pd(_mm256_setzero_pd(), _mm256_mul_pd(a[0], b[0]));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(a[1], b[1]));
+        return _mm256_add_pd(sum, _mm256_mul_pd(a[2], b[2]));
+    }
+
+    // Rayon de chaque voie dans son repère local, comme Object::intersect :
+    // mul(i_transform, {origin,1}) et mul(i_transform, {direction,0}), soit ((c0*x + c1*y) + c2*z) + c3*w.
+    RAY_TARGET_AVX2
+    inline void local_rays_pd(const PrimitivePack4& pack, const Ray& ray, __m256d o[3], __m256d d[3]) {
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d zero = _mm256_setzero_pd();
+        __m256d ro[3], rd[3];
+        for (int k = 0; k < 3; k++) {
+            ro[k] = _mm256_set1_pd(ray.origin[k]);
+            rd[k] = _mm256_set1_pd(ray.direction[k]);
+        }
+        for (int row = 0; row < 3; row++) {
+            __m256d c[4];
+            for (int col = 0; col < 4; col++) {
+                c[col] = _mm256_load_pd(pack.i_transform[col][row]);
+            }
+            o[row] = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c[0], ro[0]), _mm256_mul_pd(c[1], ro[1])),
+                                                 _mm256_mul_pd(c[2], ro[2])), _mm256_mul_pd(c[3], one));
+            d[row] = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c[0], rd[0]), _mm256_mul_pd(c[1], rd[1])),
+                                                 _mm256_mul_pd(c[2], rd[2])), _mm256_mul_pd(c[3], zero));
+        }
+    }
+
+    // Valeur absolue (efface le bit de signe), comme std::abs.
+    RAY_TARGET_AVX2
+    inline __m256d abs_pd(__m256d x) {
+        return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+    }
+
+    // Racines t0 <= t1 de a t^2 + b t + c, calculées comme dans Sphere et Cylinder::local_intersect.
+    RAY_TARGET_AVX2
+    inline void roots_pd(__m256d a, __m256d b, __m256d discriminant, __m256d* t0, __m256d* t1) {
+        __m256d root = _mm256_sqrt_pd(discriminant);
+        __m256d two_a = _mm256_mul_pd(_mm256_set1_pd(2.0), a);
+        *t0 = _mm256_div_pd(_mm256_sub_pd(neg_pd(b), root), two_a);
+        *t1 = _mm256_div_pd(_mm256_add_pd(neg_pd(b), root), two_a);
+    }
+
+    // Masque des voies où t est dans ]t_min, t_max[.
+    RAY_TARGET_AVX2
+    inline __m256d open_range_pd(__m256d t, double t_min, double t_max) {
+        return _mm256_and_pd(_mm256_cmp_pd(t, _mm256_set1_pd(t_min), _CMP_GT_OQ),
+                             _mm256_cmp_pd(t, _mm256_set1_pd(t_max), _CMP_LT_OQ));
+    }
+
+    // La profondeur retenue est t0 si t0_ok, sinon t1 ; le masque indique si l'une des deux l'est.
+    RAY_TARGET_AVX2
+    inline __m256d pick_root_pd(__m256d t0, __m256d t1, __m256d t0_ok, __m256d t1_ok, __m256d* hit) {
+        *hit = _mm256_or_pd(t0_ok, t1_ok);
+        return _mm256_blendv_pd(t1, t0, t0_ok);
+    }
+
+    RAY_TARGET_AVX2
+    inline uint32_t lane_mask_pd(__m256d mask, int count) {
+        return static_cast<uint32_t>(_mm256_movemask_pd(mask)) & ((1u << count) - 1);
+    }
+}
+
+RAY_TARGET_AVX2
+uint32_t intersect_spheres4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t) {
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+
+    __m256d o[3], d[3];
+    local_rays_pd(pack, ray, o, d);
+
+    __m256d a = dot_pd(d, d);
+    __m256d b = _mm256_mul_pd(two, dot_pd(d, o));
+    __m256d c = _mm256_sub_pd(dot_pd(o, o), _mm256_load_pd(pack.radius2));
+    __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(_mm256_mul_pd(four, a), c));
+
+    // Même rejet que le code scalaire : discriminant négatif (ou NaN).
+    __m256d valid = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+
+    __m256d t0, t1, hit;
+    roots_pd(a, b, discriminant, &t0, &t1);
+    _mm256_storeu_pd(t, pick_root_pd(t0, t1, open_range_pd(t0, t_min, t_max), open_range_pd(t1, t_min, t_max), &hit));
+    return lane_mask_pd(_mm256_and_pd(valid, hit), pack.count);
+}
+
+RAY_TARGET_AVX2
+uint32_t intersect_quads4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half_size = _mm256_load_pd(pack.extent);
+    const __m256d minus_half_size = neg_pd(half_size);
+
+    __m256d o[3], d[3];
+    local_rays_pd(pack, ray, o, d);
+
+    // Plan z = 0 de normale Z+, évalué comme dans Quad::local_intersect.
+    const __m256d normal[3] = {zero, zero, one};
+    __m256d denominator = dot_pd(d, normal);
+
+    // Rayon parallèle : "std::abs(denominator) < 1e-6" rejette la voie (NaN compris, comme le test scalaire).
+    __m256d valid = _mm256_cmp_pd(abs_pd(denominator), _mm256_set1_pd(1e-6), _CMP_NLT_UQ);
+
+    __m256d to_plane[3] = {_mm256_sub_pd(zero, o[0]), _mm256_sub_pd(zero, o[1]), _mm256_sub_pd(zero, o[2])};
+    __m256d depth = _mm256_div_pd(dot_pd(to_plane, normal), denominator);
+
+    // Bornes inclusives ; les comparaisons non ordonnées reproduisent les tests "t < t_min || t > t_max".
+    __m256d in_range = _mm256_and_pd(_mm256_cmp_pd(depth, _mm256_set1_pd(t_min), _CMP_NLT_UQ),
+                                     _mm256_cmp_pd(depth, _mm256_set1_pd(t_max), _CMP_NGT_UQ));
+
+    __m256d x = _mm256_add_pd(o[0], _mm256_mul_pd(depth, d[0]));
+    __m256d y = _mm256_add_pd(o[1], _mm256_mul_pd(depth, d[1]));
+    __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, minus_half_size, _CMP_NLT_UQ), _mm256_cmp_pd(x, half_size, _CMP_NGT_UQ)),
+                                   _mm256_and_pd(_mm256_cmp_pd(y, minus_half_size, _CMP_NLT_UQ), _mm256_cmp_pd(y, half_size, _CMP_NGT_UQ)));
+
+    _mm256_storeu_pd(t, depth);
+    return lane_mask_pd(_mm256_and_pd(_mm256_and_pd(valid, in_range), inside), pack.count);
+}
+
+RAY_TARGET_AVX2
+uint32_t intersect_cylinders4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t) {
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d half_height = _mm256_load_pd(pack.extent);
+
+    __m256d o[3], d[3];
+    local_rays_pd(pack, ray, o, d);
+
+    // Tube ouvert d'axe Y, de rayon et de demi-hauteur donnés, comme Cylinder::local_intersect.
+    __m256d a = _mm256_add_pd(_mm256_mul_pd(d[0], d[0]), _mm256_mul_pd(d[2], d[2]));
+    __m256d b = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, o[0]), d[0]), _mm256_mul_pd(_mm256_mul_pd(two, o[2]), d[2]));
+    __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(o[0], o[0]), _mm256_mul_pd(o[2], o[2])), _mm256_load_pd(pack.radius2));
+    __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(_mm256_mul_pd(four, a), c));
+
+    __m256d valid = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_NLT_UQ);
+
+    // Une racine ne compte que si le point est dans la hauteur du tube.
+    __m256d t0, t1, hit;
+    roots_pd(a, b, discriminant, &t0, &t1);
+    __m256d y0 = _mm256_add_pd(o[1], _mm256_mul_pd(t0, d[1]));
+    __m256d y1 = _mm256_add_pd(o[1], _mm256_mul_pd(t1, d[1]));
+    __m256d t0_ok = _mm256_and_pd(open_range_pd(t0, t_min, t_max), _mm256_cmp_pd(abs_pd(y0), half_height, _CMP_LE_OQ));
+    __m256d t1_ok = _mm256_and_pd(open_range_pd(t1, t_min, t_max), _mm256_cmp_pd(abs_pd(y1), half_height, _CMP_LE_OQ));
+    _mm256_storeu_pd(t, pick_root_pd(t0, t1, t0_ok, t1_ok, &hit));
+    return lane_mask_pd(_mm256_and_pd(valid, hit), pack.count);
+}
+
+#endif
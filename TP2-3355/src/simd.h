@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "basic.h"
+
+// Les noyaux AVX2 ne sont compilés que pour x86 ; ils sont activés fonction par fonction
+// (attribut target) afin que l'exécutable reste utilisable sur un processeur sans AVX2.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RAY_HAS_AVX2_KERNELS 1
+#define RAY_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define RAY_HAS_AVX2_KERNELS 1
+#define RAY_TARGET_AVX2
+#else
+#define RAY_HAS_AVX2_KERNELS 0
+#define RAY_TARGET_AVX2
+#endif
+
+// Jeux d'instructions disponibles pour les noyaux d'intersection.
+enum SimdLevel {
+    // Choisit le meilleur niveau supporté par le processeur.
+    SIMD_AUTO,
+    // Code scalaire en double précision uniquement.
+    SIMD_SCALAR,
+    // Noyaux 8 voies en float (AVX2).
+    SIMD_AVX2,
+};
+
+// Sélection, à l'exécution, des noyaux SIMD.
+// Le niveau actif est global et fixé avant le rendu (directive "simd" de la scène).
+namespace Simd {
+    // Vrai si le processeur (et le compilateur) supportent les noyaux AVX2.
+    bool avx2_supported();
+
+    // Résout SIMD_AUTO et remplace un niveau non supporté par SIMD_SCALAR.
+    SimdLevel resolve(SimdLevel requested);
+
+    // Fixe le niveau actif (après résolution) et le retourne.
+    SimdLevel set_active(SimdLevel requested);
+
+    // Niveau actif ; SIMD_SCALAR tant que set_active n'a pas été appelé.
+    SimdLevel active();
+
+    // Nom lisible d'un niveau ("auto", "scalar", "avx2").
+    const char* name(SimdLevel level);
+
+    // Analyse un nom de niveau ; retourne false s'il est inconnu.
+    bool parse(const std::string& name, SimdLevel* level);
+}
+
+// Nombre de triangles testés ensemble par le noyau AVX2.
+#define TRIANGLE_PACK_WIDTH 8
+
+// Jusqu'à 8 triangles d'une même feuille, en structure de tableaux (SoA) et en float.
+// Les sommets de base sont exprimés relativement à origin (en double) afin de limiter
+// la perte de précision lorsque le maillage est loin de l'origine.
+// Les voies inutilisées ont des arêtes nulles et ne sont jamais acceptées.
+struct alignas(32) TrianglePack8 {
+    // Sommet A - origin, par composante.
+    float p0[3][TRIANGLE_PACK_WIDTH];
+    // Arêtes B - A et C - A, par composante.
+    float edge1[3][TRIANGLE_PACK_WIDTH];
+    float edge2[3][TRIANGLE_PACK_WIDTH];
+
+    // Point de référence du paquet.
+    double3 origin;
+};
+
+// Teste le rayon contre les 8 triangles du paquet avec Möller-Trumbore en float.
+// Retourne un masque des voies candidates (bit i pour la voie i). Le test est volontairement
+// conservateur : une voie rejetée ne peut pas être touchée par le test exact en double,
+// mais une voie acceptée doit être confirmée par celui-ci.
+#if RAY_HAS_AVX2_KERNELS
+RAY_TARGET_AVX2
+uint32_t intersect_pack8_avx2(const TrianglePack8& pack, const Ray& ray, double t_min, double t_max);
+#endif
+
+// Nombre de primitives analytiques (sphères, quads, cylindres) testées ensemble par les noyaux AVX2.
+#define PRIMITIVE_PACK_WIDTH 4
+
+// Jusqu'à 4 primitives analytiques du même type, en structure de tableaux (SoA) et en double.
+// Les noyaux refont, voie par voie, exactement les mêmes opérations que le code scalaire
+// (transformation du rayon comprise) : leurs résultats sont identiques, sans test de confirmation.
+struct alignas(32) PrimitivePack4 {
+    // Transformation global --> local de chaque voie : i_transform[colonne][ligne][voie] (lignes 0..2).
+    double i_transform[4][3][PRIMITIVE_PACK_WIDTH];
+
+    // Carré du rayon (sphères et cylindres).
+    double radius2[PRIMITIVE_PACK_WIDTH];
+
+    // Demi-largeur (quads) ou demi-hauteur (cylindres).
+    double extent[PRIMITIVE_PACK_WIDTH];
+
+    // Nombre de voies utilisées.
+    int count;
+};
+
+// Teste le rayon (repère global) contre les primitives du paquet. Retourne le masque des voies
+// touchées dans l'intervalle, avec leur profondeur dans t ; les conditions (bornes strictes ou non)
+// sont celles de local_intersect du type correspondant.
+#if RAY_HAS_AVX2_KERNELS
+RAY_TARGET_AVX2
+uint32_t intersect_spheres4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t);
+RAY_TARGET_AVX2
+uint32_t intersect_quads4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t);
+RAY_TARGET_AVX2
+uint32_t intersect_cylinders4_avx2(const PrimitivePack4& pack, const Ray& ray, double t_min, double t_max, double* t);
+#endif
@@ -0,0 +1,78 @@
+#include "stats.h"
+
+#include <atomic>
+#include <iomanip>
+
+namespace {
+    const char* stat_names[STAT_COUNT] = {
+        "BVH nodes visited",
+        "BVH nodes missed",
+        "BVH nodes pruned by closer hit",
+        "BVH primitives pruned by closer hit",
+        "Primitive intersection tests",
+        "Closest-hit queries",
+        "Occlusion queries",
+        "Ray packet queries",
+        "BVH nodes visited by packets",
+        "Divergent packets traced per ray",
+        "Triangle packs tested (AVX2)",
+        "Triangle pack candidates",
+        "Primitive packs tested (AVX2)",
+        "Secondary rays traced",
+        "Paths cut by min throughput",
+        "Paths cut by Russian roulette",
+        "Shadow rays",
+        "Shadow probes fast path (lit)",
+        "Shadow probes fast path (occluded)",
+        "Shadow probes in penumbra",
+    };
+
+    std::atomic<uint64_t> global_counters[STAT_COUNT];
+
+    // Compteurs propres à un fil ; fusionnés automatiquement à la fin du fil.
+    struct LocalCounters {
+        uint64_t values[STAT_COUNT] = {};
+
+        void flush() {
+            for (int i = 0; i < STAT_COUNT; i++) {
+                if (values[i]) {
+                    global_counters[i].fetch_add(values[i], std::memory_order_relaxed);
+                    values[i] = 0;
+                }
+            }
+        }
+
+        ~LocalCounters() { flush(); }
+    };
+
+    thread_local LocalCounters local_counters;
+}
+
+void Stats::add(StatCounter counter, uint64_t n) {
+    local_counters.values[counter] += n;
+}
+
+void Stats::flush() {
+    local_counters.flush();
+}
+
+void Stats::reset() {
+    for (int i = 0; i < STAT_COUNT; i++) {
+        local_counters.values[i] = 0;
+        global_counters[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Stats::get(StatCounter counter) {
+    return global_counters[counter].load(std::memory_order_relaxed);
+}
+
+void Stats::report(std::ostream& out) {
+    flush();
+    for (int i = 0; i < STAT_COUNT; i++) {
+        uint64_t value = get(static_cast<StatCounter>(i));
+        if (value) {
+            out << "  " << std::left << std::setw(40) << stat_names[i] << value << std::endl;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+// Active la collecte des compteurs de performance (voir l'option RAY_STATS dans CMakeLists.txt).
+#ifndef RAY_STATS
+#define RAY_STATS 1
+#endif
+
+// Les compteurs de performance disponibles.
+enum StatCounter {
+    // Noeuds du BVH dont la boîte a été intersectée puis visitée.
+    STAT_BVH_NODES_VISITED,
+    // Noeuds rejetés parce que le rayon manque leur boîte.
+    STAT_BVH_NODES_MISSED,
+    // Noeuds rejetés uniquement grâce au rétrécissement de t_max par une intersection plus proche.
+    STAT_BVH_NODES_PRUNED,
+    // Objets dont l'intersection a été évitée par l'élagage d'une feuille.
+    STAT_BVH_PRIMITIVES_PRUNED,
+    // Tests d'intersection objet effectués par un conteneur.
+    STAT_PRIMITIVES_TESTED,
+    // Requêtes d'intersection (plus proche) adressées au conteneur.
+    STAT_CLOSEST_HIT_QUERIES,
+    // Requêtes d'occlusion (premier impact) adressées au conteneur.
+    STAT_OCCLUSION_QUERIES,
+    // Requêtes adressées au conteneur pour des paquets de rayons.
+    STAT_PACKET_QUERIES,
+    // Noeuds du BVH visités par un paquet entier (un seul test pour tous ses rayons).
+    STAT_PACKET_NODES_VISITED,
+    // Paquets divergents parcourus rayon par rayon.
+    STAT_PACKET_FALLBACKS,
+    // Paquets de 8 triangles testés par le noyau AVX2.
+    STAT_TRIANGLE_PACKS_TESTED,
+    // Triangles retenus par le noyau AVX2, à confirmer par le test exact.
+    STAT_TRIANGLE_PACK_CANDIDATES,
+    // Paquets de primitives analytiques (sphères, quads, cylindres) testés par un noyau AVX2.
+    STAT_PRIMITIVE_PACKS_TESTED,
+    // Rayons secondaires (réflexion, réfraction) effectivement lancés.
+    STAT_SECONDARY_RAYS,
+    // Rayons secondaires abandonnés parce que leur contribution est sous min_throughput.
+    STAT_PATHS_CUT_BY_THROUGHPUT,
+    // Rayons secondaires abandonnés par la roulette russe.
+    STAT_PATHS_CUT_BY_ROULETTE,
+    // Rayons d'ombre lancés.
+    STAT_SHADOW_RAYS,
+    // Ombres adaptatives : paires (point, lumière) dont toutes les sondes sont libres.
+    STAT_SHADOW_PROBES_LIT,
+    // Ombres adaptatives : paires (point, lumière) dont toutes les sondes sont occludées.
+    STAT_SHADOW_PROBES_OCCLUDED,
+    // Ombres adaptatives : sondes en désaccord, l'ensemble complet de rayons est lancé.
+    STAT_SHADOW_PROBES_PENUMBRA,
+
+    STAT_COUNT
+};
+
+// Compteurs de performance agrégés sur tous les fils.
+// Chaque fil incrémente ses propres compteurs (thread_local) sans synchronisation ;
+// ils sont fusionnés dans le total global à la fin de chaque tâche d'un ThreadPool,
+// à la fin du fil ou lors du rapport.
+namespace Stats {
+    // Ajoute n au compteur du fil courant.
+    void add(StatCounter counter, uint64_t n = 1);
+
+    // Fusionne les compteurs du fil courant dans le total global.
+    void flush();
+
+    // Remet le total global et les compteurs du fil courant à zéro. Les autres fils doivent
+    // avoir fusionné les leurs (p. ex. aucune tâche de ThreadPool en cours).
+    void reset();
+
+    // Valeur globale d'un compteur (après flush).
+    uint64_t get(StatCounter counter);
+
+    // Écrit les compteurs non nuls dans le flux donné.
+    void report(std::ostream& out);
+}
+
+#if RAY_STATS
+#define STAT_ADD(counter, n) Stats::add(counter, n)
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#endif
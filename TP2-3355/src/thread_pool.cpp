@@ -0,0 +1,147 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "stats.h"
+
+namespace {
+    // Indice du participant pour le fil courant (-1 hors du bassin).
+    thread_local int t_pool_index = -1;
+}
+
+int ThreadPool::resolve_thread_count(int num_threads) {
+    if (num_threads > 0) {
+        return num_threads;
+    }
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+ThreadPool::ThreadPool(int num_threads) : queued(0), next_queue(0), stopping(false) {
+    int count = resolve_thread_count(num_threads);
+
+    for (int i = 0; i < count; i++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    // Le participant 0 est le fil appelant ; on ne lance que les autres.
+    for (int i = 1; i < count; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    sleep_cv.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::current_index() {
+    return t_pool_index;
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> task) {
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+
+    int index = t_pool_index;
+    if (index < 0 || index >= size()) {
+        index = next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(Task{std::move(task), &group});
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued.fetch_add(1, std::memory_order_release);
+    }
+    sleep_cv.notify_one();
+}
+
+bool ThreadPool::try_pop(int index, Task* task) {
+    // Notre propre file, par la fin.
+    {
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Vol dans les autres files, par le début.
+    for (int offset = 1; offset < size(); offset++) {
+        WorkQueue& victim = *queues[(index + offset) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(Task& task) {
+    task.fn();
+    // Les compteurs de la tâche sont visibles dès que le groupe est terminé : un rapport fait
+    // pendant la vie du bassin n'attend pas la fin des fils.
+    Stats::flush();
+    task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::worker_loop(int index) {
+    t_pool_index = index;
+
+    while (true) {
+        Task task;
+        if (try_pop(index, &task)) {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_cv.wait(lock, [&] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    // Le fil appelant devient le participant 0 le temps de l'attente.
+    int previous_index = t_pool_index;
+    if (previous_index < 0) {
+        t_pool_index = 0;
+    }
+
+    while (!group.done()) {
+        Task task;
+        if (try_pop(t_pool_index, &task)) {
+            run(task);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    t_pool_index = previous_index;
+}
+
+void parallel_for(ThreadPool& pool, int count, const std::function<void(int, int)>& fn) {
+    TaskGroup group;
+    for (int i = 0; i < count; i++) {
+        pool.submit(group, [&fn, i] { fn(i, ThreadPool::current_index()); });
+    }
+    pool.wait(group);
+}
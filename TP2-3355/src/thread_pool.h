@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Un groupe de tâches dont on peut attendre la complétion.
+// Le compteur est incrémenté à la soumission et décrémenté à la fin de chaque tâche.
+class TaskGroup {
+public:
+    TaskGroup() : pending(0) {}
+
+    // Vrai lorsque toutes les tâches du groupe sont terminées.
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> pending;
+};
+
+// Bassin de fils d'exécution avec vol de travail (work-stealing).
+//
+// Chaque participant possède sa propre file : il dépile ses tâches par la fin (LIFO, bonne localité)
+// alors que les participants inactifs volent par le début (FIFO, gros morceaux de travail).
+// Le fil appelant participe lui aussi lorsqu'il attend un groupe (indice 0), de sorte qu'un
+// bassin de N participants ne crée que N-1 fils supplémentaires.
+class ThreadPool {
+public:
+    // num_threads <= 0 : utilise tous les coeurs disponibles.
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Nombre de participants (fil appelant inclus).
+    int size() const { return static_cast<int>(queues.size()); }
+
+    // Soumet une tâche au groupe. Appelée depuis un participant, la tâche est poussée
+    // dans sa propre file, sinon elle est distribuée à tour de rôle.
+    void submit(TaskGroup& group, std::function<void()> task);
+
+    // Exécute des tâches (les siennes ou volées) jusqu'à ce que le groupe soit terminé.
+    // Peut être appelée récursivement depuis une tâche.
+    void wait(TaskGroup& group);
+
+    // Indice du participant courant dans [0, size()), ou -1 hors du bassin.
+    static int current_index();
+
+    // Convertit un nombre de fils demandé en nombre effectif (<= 0 -> nombre de coeurs).
+    static int resolve_thread_count(int num_threads);
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+
+    // File propre à un participant. Alignée pour éviter le faux partage entre coeurs.
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<int> queued;
+    std::atomic<unsigned> next_queue;
+    std::atomic<bool> stopping;
+
+    void worker_loop(int index);
+
+    // Tente de récupérer une tâche pour le participant donné : sa file d'abord, puis vol.
+    bool try_pop(int index, Task* task);
+
+    void run(Task& task);
+};
+
+// Découpe [0, count) en tâches exécutées en parallèle et attend la fin.
+// fn(i, thread_index) est appelée une fois pour chaque i.
+void parallel_for(ThreadPool& pool, int count, const std::function<void(int, int)>& fn);
@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "raytracer.h"
+#include "thread_pool.h"
+
+// Nombre maximal d'échantillons (rayons primaires) en vol dans une vague ; borne la mémoire des files.
+#define WAVEFRONT_BATCH_SIZE 65536
+// Nombre d'éléments d'une file traités par une même tâche.
+#define WAVEFRONT_CHUNK_SIZE 256
+
+namespace {
+    // Un sommet de l'arbre de rayons d'un échantillon : le rayon à prolonger, puis l'intersection
+    // trouvée et son ombrage. Les enfants d'un sommet (réflexion, réfraction) sont contigus et
+    // toujours placés après lui dans la file.
+    struct PathVertex {
+        Ray ray;
+        int depth = 0;
+        // Contribution du chemin et identifiant dans l'arbre (voir Raytracer::continue_path).
+        double throughput = 1;
+        uint32_t key = 1;
+        // Enfants [first_child, first_child + num_children).
+        int first_child = 0;
+        int num_children = 0;
+        // Copie du générateur de l'échantillon ; ses flux ne dépendent que de la dimension demandée.
+        Sampler sampler;
+        bool hit_found = false;
+        Intersection hit;
+        // Ombrage local, non pondéré.
+        double3 color{0, 0, 0};
+    };
+
+    // Un paquet de rayons d'ombre d'une lumière pour un sommet touché : les rayons
+    // [first_sample, first_sample + PACKET_MAX_RAYS) d'un ensemble de set_size points.
+    struct ShadowQuery {
+        int vertex;
+        int light;
+        int first_sample;
+        int set_size;
+        // Vrai pour les sondes des ombres adaptatives.
+        bool probe;
+        RayPacket packet;
+        int num_occluded = 0;
+    };
+
+    // Ajoute les requêtes couvrant un ensemble complet de set_size rayons d'ombre.
+    void add_shadow_queries(std::vector<ShadowQuery>* shadows, int vertex, int light, int set_size, bool probe) {
+        for (int first = 0; first < set_size; first += PACKET_MAX_RAYS) {
+            ShadowQuery query;
+            query.vertex = vertex;
+            query.light = light;
+            query.first_sample = first;
+            query.set_size = set_size;
+            query.probe = probe;
+            shadows->push_back(query);
+        }
+    }
+
+    // Applique fn(begin, end) en parallèle sur des morceaux de [begin, end).
+    void parallel_chunks(ThreadPool& pool, int begin, int end, const std::function<void(int, int)>& fn) {
+        int num_chunks = (end - begin + WAVEFRONT_CHUNK_SIZE - 1) / WAVEFRONT_CHUNK_SIZE;
+        parallel_for(pool, num_chunks, [&](int ichunk, int) {
+            int chunk_begin = begin + ichunk * WAVEFRONT_CHUNK_SIZE;
+            fn(chunk_begin, std::min(chunk_begin + WAVEFRONT_CHUNK_SIZE, end));
+        });
+    }
+}
+
+// Chaque vague contient un échantillon de tous les pixels qui n'ont pas encore convergé.
+// Les rayons d'une même profondeur sont traités ensemble, étape par étape ; les contributions
+// sont ensuite sommées en profondeur d'abord, dans le même ordre que trace_hit, ce qui rend
+// le résultat identique à celui de l'intégrateur récursif.
+void Raytracer::render_wavefront(const Scene& scene, const CameraBasis& basis, ThreadPool& pool,
+                                 Frame* output, double* z_buffer, std::vector<RenderThreadState>& states)
+{
+	int width = scene.resolution[0];
+	int height = scene.resolution[1];
+	int max_samples = scene.adaptive_sampling ? scene.adaptive_max_samples
+	                                          : static_cast<int>(std::ceil(scene.samples_per_pixel));
+	int num_lights = static_cast<int>(scene.lights.size());
+	std::vector<int> light_samples(num_lights);
+	std::vector<int> light_probes(num_lights);
+	for (int ilight = 0; ilight < num_lights; ilight++) {
+		light_samples[ilight] = shadow_samples(scene, ilight);
+		light_probes[ilight] = shadow_probes(scene, ilight);
+	}
+
+	std::vector<PixelAccumulator> pixels(width * height);
+	std::vector<int> active;
+	std::vector<PathVertex> vertices;
+	std::vector<ShadowQuery> shadows;
+	std::vector<int> shadow_occluded;
+	std::vector<int> shadow_traced;
+	std::vector<PathVertex> children;
+	std::vector<int> num_children;
+
+	// Lance les requêtes d'ombre [first, last) en parallèle.
+	auto trace_shadow_queries = [&](int first, int last) {
+		parallel_chunks(pool, first, last, [&](int chunk_begin, int chunk_end) {
+			for (int q = chunk_begin; q < chunk_end; q++) {
+				ShadowQuery& query = shadows[q];
+				const PathVertex& vertex = vertices[query.vertex];
+				Sampler sampler = vertex.sampler;
+				shadow_rays(scene, vertex.hit, vertex.depth, query.light, query.first_sample, query.set_size,
+				            sampler, &query.packet);
+
+				bool occluded[PACKET_MAX_RAYS];
+				occluded_rays(scene, query.packet, occluded);
+				query.num_occluded = count_occluded(query.packet, occluded);
+			}
+		});
+	};
+
+	long long total_vertices = 0;
+	long long total_shadow_queries = 0;
+	int num_waves = 0;
+
+	for (int isample = 0; isample < max_samples; isample++) {
+		active.clear();
+		for (int ipixel = 0; ipixel < width * height; ipixel++) {
+			if (!pixels[ipixel].done) {
+				active.push_back(ipixel);
+			}
+		}
+		if (active.empty()) {
+			break;
+		}
+
+		for (size_t first_path = 0; first_path < active.size(); first_path += WAVEFRONT_BATCH_SIZE) {
+			int num_paths = static_cast<int>(std::min<size_t>(WAVEFRONT_BATCH_SIZE, active.size() - first_path));
+			num_waves++;
+
+			// Génération : un rayon primaire par pixel actif.
+			vertices.assign(num_paths, PathVertex());
+			parallel_chunks(pool, 0, num_paths, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					int ipixel = active[first_path + i];
+					PathVertex& vertex = vertices[i];
+					vertex.sampler = Sampler(scene.seed, ipixel, isample);
+					vertex.ray = camera_ray(scene, basis, ipixel % width, ipixel / width, vertex.sampler);
+				}
+			});
+
+			int begin = 0;
+			int end = num_paths;
+			while (begin < end) {
+				// Prolongement : intersection la plus proche, par paquets de rayons consécutifs.
+				parallel_chunks(pool, begin, end, [&](int chunk_begin, int chunk_end) {
+					for (int first = chunk_begin; first < chunk_end; first += PACKET_MAX_RAYS) {
+						RayPacket packet;
+						packet.t_min = EPSILON;
+						packet.count = std::min(PACKET_MAX_RAYS, chunk_end - first);
+						for (int i = 0; i < packet.count; i++) {
+							packet.rays[i] = vertices[first + i].ray;
+							packet.t_max[i] = scene.camera.z_far;
+						}
+
+						Intersection hits[PACKET_MAX_RAYS];
+						bool hit_found[PACKET_MAX_RAYS];
+						intersect_rays(scene, packet, hits, hit_found);
+						for (int i = 0; i < packet.count; i++) {
+							vertices[first + i].hit_found = hit_found[i];
+							if (hit_found[i]) {
+								vertices[first + i].hit = hits[i];
+							}
+						}
+					}
+				});
+
+				// Ombres : une requête par paquet de rayons, par lumière et par rayon touché.
+				// Avec les ombres adaptatives, seules les sondes sont lancées dans un premier temps.
+				shadows.clear();
+				for (int v = begin; v < end; v++) {
+					if (!vertices[v].hit_found) {
+						continue;
+					}
+					for (int ilight = 0; ilight < num_lights; ilight++) {
+						if (light_probes[ilight] > 0) {
+							add_shadow_queries(&shadows, v, ilight, light_probes[ilight], true);
+						} else {
+							add_shadow_queries(&shadows, v, ilight, light_samples[ilight], false);
+						}
+					}
+				}
+				int num_first_round = static_cast<int>(shadows.size());
+				trace_shadow_queries(0, num_first_round);
+
+				// Les sondes en désaccord (pénombre) ajoutent l'ensemble complet de rayons.
+				for (int q = 0; q < num_first_round; q++) {
+					const ShadowQuery& query = shadows[q];
+					if (query.probe && !shadow_probes_agree(query.num_occluded, query.set_size)) {
+						add_shadow_queries(&shadows, query.vertex, query.light, light_samples[query.light], false);
+					}
+				}
+				trace_shadow_queries(num_first_round, static_cast<int>(shadows.size()));
+				total_shadow_queries += shadows.size();
+
+				// Rayons occludés et lancés par rayon touché et par lumière.
+				shadow_occluded.assign(static_cast<size_t>(end - begin) * num_lights, 0);
+				shadow_traced.assign(static_cast<size_t>(end - begin) * num_lights, 0);
+				for (const ShadowQuery& query : shadows) {
+					size_t index = static_cast<size_t>(query.vertex - begin) * num_lights + query.light;
+					shadow_occluded[index] += query.num_occluded;
+					shadow_traced[index] += query.packet.count;
+				}
+
+				// Ombrage local et rayons secondaires qui survivent à continue_path.
+				children.resize(static_cast<size_t>(end - begin) * MAX_SECONDARY_RAYS);
+				num_children.assign(end - begin, 0);
+				parallel_chunks(pool, begin, end, [&](int chunk_begin, int chunk_end) {
+					std::vector<double> occlusion(num_lights);
+					for (int v = chunk_begin; v < chunk_end; v++) {
+						PathVertex& vertex = vertices[v];
+						if (!vertex.hit_found) {
+							continue;
+						}
+						for (int ilight = 0; ilight < num_lights; ilight++) {
+							size_t index = static_cast<size_t>(v - begin) * num_lights + ilight;
+							occlusion[ilight] = static_cast<double>(shadow_occluded[index]) / shadow_traced[index];
+						}
+						vertex.color = shade_occluded(scene, vertex.hit, occlusion.data());
+
+						SecondaryRay secondary[MAX_SECONDARY_RAYS];
+						int num_secondary = scatter(scene, vertex.ray, vertex.hit, vertex.depth, secondary);
+						PathVertex* out = &children[(v - begin) * MAX_SECONDARY_RAYS];
+						int count = 0;
+						for (int i = 0; i < num_secondary; i++) {
+							PathVertex& child = out[count];
+							child = PathVertex();
+							child.throughput = vertex.throughput * secondary[i].weight;
+							child.key = (vertex.key << 1) | static_cast<uint32_t>(i);
+							child.sampler = vertex.sampler;
+							if (continue_path(scene, child.sampler, vertex.depth + 1, child.key, &child.throughput)) {
+								child.ray = secondary[i].ray;
+								child.depth = vertex.depth + 1;
+								count++;
+							}
+						}
+						num_children[v - begin] = count;
+					}
+				});
+
+				// Les enfants sont ajoutés dans l'ordre des sommets : la file suivante est déterministe.
+				for (int v = begin; v < end; v++) {
+					vertices[v].first_child = static_cast<int>(vertices.size());
+					vertices[v].num_children = num_children[v - begin];
+					for (int i = 0; i < num_children[v - begin]; i++) {
+						vertices.push_back(children[(v - begin) * MAX_SECONDARY_RAYS + i]);
+					}
+				}
+
+				begin = end;
+				end = static_cast<int>(vertices.size());
+			}
+			total_vertices += vertices.size();
+
+			// Composition : somme des contributions en profondeur d'abord, premier enfant en premier.
+			parallel_chunks(pool, 0, num_paths, [&](int chunk_begin, int chunk_end) {
+				std::vector<int> stack;
+				for (int i = chunk_begin; i < chunk_end; i++) {
+					double3 color{0, 0, 0};
+					stack.assign(1, i);
+					while (!stack.empty()) {
+						const PathVertex& vertex = vertices[stack.back()];
+						stack.pop_back();
+						if (!vertex.hit_found) {
+							continue;
+						}
+						color += vertex.throughput * vertex.color;
+						for (int c = vertex.num_children - 1; c >= 0; c--) {
+							stack.push_back(vertex.first_child + c);
+						}
+					}
+
+					double depth = vertices[i].hit_found ? vertices[i].hit.depth : scene.camera.z_far;
+					add_sample(scene, &pixels[active[first_path + i]], color, depth);
+				}
+			});
+			states[0].primary_rays += num_paths;
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			resolve_pixel(scene, x, y, pixels[x + y * width], output, z_buffer);
+		}
+	}
+
+	std::cout << "Wavefront: " << num_waves << " wave(s), " << total_vertices << " rays traced, "
+	          << total_shadow_queries << " shadow packets, " << pool.size() << " thread(s)" << std::endl;
+}